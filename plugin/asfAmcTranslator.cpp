@@ -0,0 +1,579 @@
+// ASF/AMC import, see asfAmcTranslator.h
+
+#include "asfAmcTranslator.h"
+#include "clip.h"
+
+#include <maya/MGlobal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+class AsfBone {
+public:
+    std::string name;
+    double direction[3] = { 0.0, 0.0, 0.0 };
+    double length = 0.0;
+    // C, rotation of the bone axis
+    double axis[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    // ChannelType of each value of the bone in a frame of the AMC file, -1
+    // for the values that are ignored (bone length)
+    std::vector<int> dofs;
+    std::vector<std::string> children;
+    // Joint created for the bone and column of its position channels, -1 if
+    // the bone has none
+    int joint = -1;
+    int positionColumns[3] = { -1, -1, -1 };
+};
+
+// Rotation applying the angles (degrees) around the axes in the given order,
+// the first axis being applied first.
+static void eulerRotation(const int* axes, const double* degrees, int nbAxes, double rotation[9]) {
+    static const double identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    std::memcpy(rotation, identity, sizeof(identity));
+    for (int n = 0; n < nbAxes; n++) {
+        double axis[3] = { 0.0, 0.0, 0.0 };
+        axis[axes[n]] = 1.0;
+        double axisRotation[9];
+        axisAngle(axis, degrees[n] * M_PI / 180.0, axisRotation);
+        multiply3(axisRotation, rotation, rotation);
+    }
+}
+
+// Reads "a b c XYZ" style axis angles into a rotation
+static bool readAsfAxis(std::istream& line, double angleToDegrees, double rotation[9]) {
+    double angles[3];
+    std::string order;
+    line >> angles[0] >> angles[1] >> angles[2] >> order;
+    if (!line || order.size() != 3) {
+        return false;
+    }
+    int axes[3];
+    double degrees[3];
+    for (int i = 0; i < 3; i++) {
+        axes[i] = std::toupper((unsigned char)order[i]) - 'X';
+        if (axes[i] < 0 || axes[i] > 2) {
+            return false;
+        }
+        degrees[i] = angles[axes[i]] * angleToDegrees;
+    }
+    eulerRotation(axes, degrees, 3, rotation);
+    return true;
+}
+
+std::map<std::string, int> correspondanceDofToChannelType = {
+    {"tx" , kPositionX},
+    {"ty" , kPositionY},
+    {"tz" , kPositionZ},
+    {"rx" , kRotationX},
+    {"ry" , kRotationY},
+    {"rz" , kRotationZ},
+    {"l" , -1}
+};
+
+class AsfSkeleton {
+public:
+    // bones[0] is the root
+    std::vector<AsfBone> bones;
+    std::map<std::string, int> boneIndices;
+    double angleToDegrees = 1.0;
+
+    bool read(std::istream& input);
+    void build(Clip& clip);
+    void findColumns(const Clip& clip);
+    // Approximate size of a frame in an AMC file, to plan the import
+    unsigned long long frameSize() const;
+};
+
+bool AsfSkeleton::read(std::istream& input) {
+    bones.resize(1);
+    bones[0].name = "root";
+    std::string rootAxis = "XYZ";
+    std::string rootOrientation = "0 0 0";
+    std::string section;
+    std::string line;
+    AsfBone* bone = nullptr;
+    while (std::getline(input, line)) {
+        std::istringstream tokens(line);
+        std::string key;
+        if (!(tokens >> key) || key[0] == '#') {
+            continue;
+        }
+        if (key[0] == ':') {
+            section = key;
+            continue;
+        }
+
+        if (section == ":units") {
+            std::string value;
+            tokens >> value;
+            if (key == "angle") {
+                angleToDegrees = value == "rad" ? 180.0 / M_PI : 1.0;
+            }
+        }
+        else if (section == ":root") {
+            if (key == "order") {
+                std::string dof;
+                while (tokens >> dof) {
+                    std::transform(dof.begin(), dof.end(), dof.begin(), ::tolower);
+                    if (!correspondanceDofToChannelType.count(dof)) {
+                        return false;
+                    }
+                    bones[0].dofs.push_back(correspondanceDofToChannelType[dof]);
+                }
+            }
+            else if (key == "position") {
+                tokens >> bones[0].direction[0] >> bones[0].direction[1] >> bones[0].direction[2];
+            }
+            else if (key == "axis") {
+                tokens >> rootAxis;
+            }
+            else if (key == "orientation") {
+                std::getline(tokens, rootOrientation);
+            }
+        }
+        else if (section == ":bonedata") {
+            if (key == "begin") {
+                bones.emplace_back();
+                bone = &bones.back();
+            }
+            else if (key == "end") {
+                bone = nullptr;
+            }
+            else if (!bone) {
+                return false;
+            }
+            else if (key == "name") {
+                tokens >> bone->name;
+            }
+            else if (key == "direction") {
+                tokens >> bone->direction[0] >> bone->direction[1] >> bone->direction[2];
+            }
+            else if (key == "length") {
+                tokens >> bone->length;
+            }
+            else if (key == "axis") {
+                if (!readAsfAxis(tokens, angleToDegrees, bone->axis)) {
+                    return false;
+                }
+            }
+            else if (key == "dof") {
+                std::string dof;
+                while (tokens >> dof) {
+                    if (!correspondanceDofToChannelType.count(dof)) {
+                        return false;
+                    }
+                    bone->dofs.push_back(correspondanceDofToChannelType[dof]);
+                }
+            }
+        }
+        else if (section == ":hierarchy") {
+            if (key == "begin" || key == "end") {
+                continue;
+            }
+            // "parent child child ...", the parent being defined later is fine
+            std::string child;
+            std::vector<std::string>* children = nullptr;
+            for (AsfBone& candidate : bones) {
+                if (candidate.name == key) {
+                    children = &candidate.children;
+                    break;
+                }
+            }
+            if (!children) {
+                return false;
+            }
+            while (tokens >> child) {
+                children->push_back(child);
+            }
+        }
+    }
+
+    // The root has no direction of its own, its position is kept there as
+    // the offset of the root joint.
+    std::istringstream rootTokens(rootOrientation + " " + rootAxis);
+    if (!readAsfAxis(rootTokens, angleToDegrees, bones[0].axis)) {
+        return false;
+    }
+    for (size_t i = 0; i < bones.size(); i++) {
+        boneIndices[bones[i].name] = i;
+    }
+    return bones.size() > 1 || !bones[0].dofs.empty();
+}
+
+// Creates the joints of the clip in depth-first order
+void AsfSkeleton::build(Clip& clip) {
+    std::vector<std::pair<int, int>> stack;
+    stack.push_back(std::make_pair(0, -1));
+    while (!stack.empty()) {
+        int boneIndex = stack.back().first;
+        int parentBone = stack.back().second;
+        AsfBone& bone = bones[boneIndex];
+        stack.pop_back();
+
+        clip.skeleton.emplace_back();
+        Node& node = clip.skeleton.back();
+        bone.joint = clip.skeleton.size() - 1;
+        node.name = bone.name;
+        if (parentBone < 0) {
+            for (int i = 0; i < 3; i++) {
+                node.offset[i] = bone.direction[i];
+            }
+        }
+        else {
+            const AsfBone& parent = bones[parentBone];
+            node.parent = parent.joint;
+            for (int i = 0; i < 3; i++) {
+                node.offset[i] = parent.direction[i] * parent.length;
+            }
+        }
+
+        bool rotation = false;
+        static const char* positionChannels[3] = { "Xposition", "Yposition", "Zposition" };
+        for (int i = 0; i < 3; i++) {
+            if (parentBone < 0 && std::count(bone.dofs.begin(), bone.dofs.end(), kPositionX + i)) {
+                node.channels.push_back(positionChannels[i]);
+            }
+            rotation = rotation || std::count(bone.dofs.begin(), bone.dofs.end(), kRotationX + i);
+        }
+        if (rotation) {
+            node.channels.push_back("Zrotation");
+            node.channels.push_back("Yrotation");
+            node.channels.push_back("Xrotation");
+        }
+
+        if (bone.children.empty() && bone.length > 0.0) {
+            Node end;
+            end.name = bone.name + "_end";
+            end.parent = bone.joint;
+            for (int i = 0; i < 3; i++) {
+                end.offset[i] = bone.direction[i] * bone.length;
+            }
+            clip.skeleton.push_back(end);
+        }
+        for (int i = bone.children.size() - 1; i >= 0; i--) {
+            if (boneIndices.count(bone.children[i])) {
+                stack.push_back(std::make_pair(boneIndices[bone.children[i]], boneIndex));
+            }
+        }
+    }
+}
+
+void AsfSkeleton::findColumns(const Clip& clip) {
+    for (AsfBone& bone : bones) {
+        if (bone.joint < 0) {
+            continue;
+        }
+        int firstChannel = clip.compiled.channelOffsets[bone.joint];
+        for (int channel = firstChannel; channel < firstChannel + clip.compiled.channelCounts[bone.joint]; channel++) {
+            if (clip.compiled.channelTypes[channel] <= kPositionZ) {
+                bone.positionColumns[clip.compiled.channelTypes[channel]] = channel;
+            }
+        }
+    }
+}
+
+unsigned long long AsfSkeleton::frameSize() const {
+    unsigned long long size = 8;
+    for (const AsfBone& bone : bones) {
+        if (!bone.dofs.empty()) {
+            size += bone.name.size() + 1 + 10 * bone.dofs.size();
+        }
+    }
+    return size;
+}
+
+// Decodes the bone lines of one AMC frame held in [begin, end)
+static bool decodeAmcFrame(const char* begin, const char* end, const AsfSkeleton& asf,
+                           const Clip& clip, MotionMatrix& motion, int frame) {
+    std::vector<double> values;
+    const char* p = begin;
+    while (p < end) {
+        const char* lineEnd = (const char*)std::memchr(p, '\n', end - p);
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        while (p < lineEnd && std::isspace((unsigned char)*p)) {
+            p++;
+        }
+        const char* nameEnd = p;
+        while (nameEnd < lineEnd && !std::isspace((unsigned char)*nameEnd)) {
+            nameEnd++;
+        }
+        if (nameEnd == p) {
+            p = lineEnd + 1;
+            continue;
+        }
+        std::map<std::string, int>::const_iterator found = asf.boneIndices.find(std::string(p, nameEnd));
+        if (found == asf.boneIndices.end()) {
+            return false;
+        }
+        const AsfBone& bone = asf.bones[found->second];
+        values.resize(bone.dofs.size());
+        if (!decodeFrame(nameEnd, lineEnd, values.data(), bone.dofs.size())) {
+            return false;
+        }
+
+        int axes[3];
+        double degrees[3];
+        int nbAxes = 0;
+        for (size_t i = 0; i < bone.dofs.size(); i++) {
+            int type = bone.dofs[i];
+            if (type >= kRotationX && nbAxes < 3) {
+                axes[nbAxes] = type - kRotationX;
+                degrees[nbAxes] = values[i] * asf.angleToDegrees;
+                nbAxes++;
+            }
+            else if (type >= kPositionX && bone.positionColumns[type] >= 0) {
+                motion.setValue(frame, bone.positionColumns[type], values[i]);
+            }
+        }
+        if (nbAxes > 0) {
+            // C * M * C^-1
+            double rotation[9];
+            eulerRotation(axes, degrees, nbAxes, rotation);
+            multiply3(bone.axis, rotation, rotation);
+            double axisTranspose[9];
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    axisTranspose[3 * i + j] = bone.axis[3 * j + i];
+                }
+            }
+            multiply3(rotation, axisTranspose, rotation);
+            setRotationChannels(clip.compiled, motion, bone.joint, frame, rotation);
+        }
+        p = lineEnd + 1;
+    }
+    return true;
+}
+
+// True for the line of an AMC frame number
+static bool isAmcFrameLine(const char* begin, const char* end) {
+    bool digits = false;
+    for (const char* p = begin; p < end; p++) {
+        if (std::isdigit((unsigned char)*p)) {
+            digits = true;
+        }
+        else if (!std::isspace((unsigned char)*p)) {
+            return false;
+        }
+    }
+    return digits;
+}
+
+// Decodes the frames of an AMC text in parallel, from firstFrame on. The
+// header lines before the first frame are skipped.
+static bool decodeAmcFrames(const char* text, const char* textEnd, const AsfSkeleton& asf,
+                            const Clip& clip, MotionMatrix& motion, int firstFrame, int nbThreads) {
+    // A frame starts after the line of its number and ends on the next one
+    std::vector<const char*> frameBegins;
+    std::vector<const char*> frameEnds;
+    const char* p = text;
+    while (p < textEnd) {
+        const char* lineEnd = (const char*)std::memchr(p, '\n', textEnd - p);
+        if (!lineEnd) {
+            lineEnd = textEnd;
+        }
+        if (isAmcFrameLine(p, lineEnd)) {
+            if (!frameBegins.empty()) {
+                frameEnds.push_back(p);
+            }
+            frameBegins.push_back(std::min(lineEnd + 1, textEnd));
+        }
+        p = lineEnd + 1;
+    }
+    if (!frameBegins.empty()) {
+        frameEnds.push_back(textEnd);
+    }
+    if (firstFrame + (int)frameBegins.size() > motion.nbFrames) {
+        return false;
+    }
+
+    std::atomic<bool> valid(true);
+    parallelFor(frameBegins.size(), nbThreads, [&](int begin, int end) {
+        for (int i = begin; i < end && valid; i++) {
+            if (!decodeAmcFrame(frameBegins[i], frameEnds[i], asf, clip, motion, firstFrame + i)) {
+                valid = false;
+            }
+        }
+    });
+    return valid;
+}
+
+// Counts the frames of an AMC text
+static int countAmcFrames(const char* text, const char* textEnd) {
+    int nbFrames = 0;
+    const char* p = text;
+    while (p < textEnd) {
+        const char* lineEnd = (const char*)std::memchr(p, '\n', textEnd - p);
+        if (!lineEnd) {
+            lineEnd = textEnd;
+        }
+        nbFrames += isAmcFrameLine(p, lineEnd);
+        p = lineEnd + 1;
+    }
+    return nbFrames;
+}
+
+
+void* AsfAmcTranslator::creator()
+{
+    return new AsfAmcTranslator();
+}
+
+MString AsfAmcTranslator::defaultExtension () const
+{
+    return "amc";
+}
+
+MString AsfAmcTranslator::filter () const
+{
+    return "*.amc";
+}
+
+MPxFileTranslator::MFileKind AsfAmcTranslator::identifyFile (
+                                        const MFileObject& fileName,
+                                        const char* buffer,
+                                        short size) const
+{
+    std::string name(fileName.resolvedName().asChar());
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".amc") == 0) {
+        return kIsMyFileType;
+    }
+    return kNotMyFileType;
+}
+
+MStatus AsfAmcTranslator::reader ( const MFileObject& file,
+                                   const MString& options,
+                                   MPxFileTranslator::FileAccessMode mode)
+{
+    const MString fname = file.expandedFullName();
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    std::string asfName;
+    double frameTime = 1.0 / 120.0;
+    for (const std::pair<MString, MString>& option : splitOptions(options)) {
+        if (option.first == "asf") {
+            asfName = option.second.asChar();
+        }
+        else if (option.first == "frameTime") {
+            frameTime = option.second.isDouble() ? option.second.asDouble() : 0.0;
+            if (!std::isfinite(frameTime) || frameTime <= 0.0) {
+                std::cerr << fname << ": the frame time must be positive\n";
+                return MS::kFailure;
+            }
+        }
+    }
+    if (asfName.empty()) {
+        std::string amcName(fname.asChar());
+        std::string base = amcName.substr(0, amcName.size() - 4);
+        size_t separator = base.find_last_of('_');
+        size_t directory = base.find_last_of("/\\");
+        asfName = base + ".asf";
+        if (!std::ifstream(asfName.c_str()) && separator != std::string::npos
+            && (directory == std::string::npos || separator > directory)) {
+            asfName = base.substr(0, separator) + ".asf";
+        }
+    }
+
+    std::ifstream asfFile(asfName.c_str(), std::ios::in);
+    if (!asfFile) {
+        std::cerr << asfName << ": could not be opened for reading\n";
+        return MS::kFailure;
+    }
+    AsfSkeleton asf;
+    if (!asf.read(asfFile)) {
+        std::cerr << asfName << ": error in file content\n";
+        return MS::kFailure;
+    }
+
+    std::ifstream inputfile(fname.asChar(), std::ios::in | std::ios::binary);
+    if (!inputfile) {
+        std::cerr << fname << ": could not be opened for reading\n";
+        return MS::kFailure;
+    }
+    inputfile.seekg(0, std::ios::end);
+    unsigned long long fileSize = inputfile.tellg();
+    inputfile.seekg(0, std::ios::beg);
+
+    std::unique_ptr<Clip> clip(new Clip());
+    clip->file = fname;
+    asf.build(*clip);
+    int nbChannels = compileClip(*clip);
+    asf.findColumns(*clip);
+
+    // AMC frames are always decoded line by line with the fast tokenizer
+    ImportPlan plan;
+    plan.build(fileSize, (int)(fileSize / asf.frameSize()) + 1, nbChannels);
+    plan.fastTokenizer = true;
+    FootCleanup footCleanup;
+    if (!plan.applyOptions(options) || !footCleanup.applyOptions(options)) {
+        std::cerr << fname << ": invalid import options \"" << options << "\"\n";
+        return MS::kFailure;
+    }
+    plan.fastTokenizer = true;
+
+    std::chrono::steady_clock::time_point headerTime = std::chrono::steady_clock::now();
+
+    MotionMatrix& motion = clip->motion;
+    if (!plan.stream) {
+        std::string text(fileSize, '\0');
+        inputfile.read(&text[0], text.size());
+        text.resize(inputfile.gcount());
+        const char* textEnd = text.data() + text.size();
+        motion.allocate(countAmcFrames(text.data(), textEnd), nbChannels, frameTime, plan.singlePrecision);
+        if (!decodeAmcFrames(text.data(), textEnd, asf, *clip, motion, 0, plan.nbThreads)) {
+            std::cerr << fname << ": error in file content with motion values\n";
+            return MS::kFailure;
+        }
+    }
+    else {
+        // Blocks of whole frames, the matrix growing block after block
+        const int blockFrames = 1024 * plan.nbThreads;
+        motion.allocate(0, nbChannels, frameTime, plan.singlePrecision);
+        std::string block;
+        std::string line;
+        int nbBlockFrames = 0;
+        bool more = true;
+        while (more) {
+            more = (bool)std::getline(inputfile, line);
+            bool frameLine = more && isAmcFrameLine(line.data(), line.data() + line.size());
+            if ((!more || (frameLine && nbBlockFrames == blockFrames)) && nbBlockFrames > 0) {
+                int firstFrame = motion.nbFrames;
+                motion.resizeFrames(firstFrame + nbBlockFrames);
+                if (!decodeAmcFrames(block.data(), block.data() + block.size(), asf, *clip, motion, firstFrame, plan.nbThreads)) {
+                    std::cerr << fname << ": error in file content with motion values\n";
+                    return MS::kFailure;
+                }
+                block.clear();
+                nbBlockFrames = 0;
+            }
+            if (more) {
+                nbBlockFrames += frameLine;
+                block += line;
+                block += '\n';
+            }
+        }
+    }
+
+    inputfile.close();
+
+    // Frames were decoded independently, each into the principal solution
+    parallelFor(clip->compiled.nbJoints(), plan.nbThreads, [&](int begin, int end) {
+        for (int joint = begin; joint < end; joint++) {
+            makeEulerContinuous(clip->compiled, motion, joint);
+        }
+    });
+
+    createClip(std::move(clip), plan, footCleanup, startTime, headerTime);
+
+    return MS::kSuccess;
+}
+
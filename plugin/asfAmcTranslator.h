@@ -0,0 +1,54 @@
+////////////////////////////////////////////////////////////////////////
+// DESCRIPTION:
+//
+// ASF/AMC (Acclaim) import. The ASF file describes the skeleton, the AMC file
+// the motion, one block per frame giving the degrees of freedom of each bone.
+// The skeleton is converted to the layout of a BVH export of the same data
+// (CMU layout), joint frames aligned with the world at rest: a bone starts at
+// the end of its parent, offset by the parent direction times its length, and
+// its rotation C * M * C^-1 is written to Zrotation Yrotation Xrotation
+// channels, C being the axis of the bone and M its motion. The clip then goes
+// through the same stages as a BVH clip.
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _asfAmcTranslator_h
+#define _asfAmcTranslator_h
+
+#include <maya/MPxFileTranslator.h>
+#include <maya/MFileObject.h>
+#include <maya/MString.h>
+
+class AsfAmcTranslator : public MPxFileTranslator {
+public:
+
+    AsfAmcTranslator () {};
+               ~AsfAmcTranslator () override {};
+
+    bool haveReadMethod() const override { return true; }
+    bool haveWriteMethod() const override { return false; }
+    bool haveReferenceMethod() const override { return false; }
+    bool haveNamespaceSupport()    const override { return true; }
+
+    static void* creator();
+
+    MString defaultExtension () const override;
+    MString filter () const override;
+
+    bool canBeOpened() const override { return true; }
+
+    MFileKind identifyFile (    const MFileObject& fileName,
+                                                const char* buffer,
+                                                short size) const override;
+
+    //The AMC file is the one imported, the ASF file is given by the "asf"
+    //option or found next to it: "02_01.amc" uses "02_01.asf", then "02.asf".
+    //The "frameTime" option gives the duration of a frame, 1/120 s by default.
+    MStatus reader ( const MFileObject& file,
+                                        const MString& optionsString,
+                            MPxFileTranslator::FileAccessMode mode) override;
+
+private:
+};
+
+#endif
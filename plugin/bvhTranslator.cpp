@@ -52,7 +52,6 @@
 //
 ////////////////////////////////////////////////////////////////////////
 
-
 #include <maya/MStatus.h>
 #include <maya/MObject.h>
 #include <maya/MFnPlugin.h>
@@ -73,6 +72,17 @@
 #include <maya/MFnAnimCurve.h>
 #include <maya/MFnDagNode.h>
 #include <maya/MDagPath.h>
+#include <maya/MDoubleArray.h>
+#include <maya/MSceneMessage.h>
+#include <maya/MCallbackIdArray.h>
+#include <maya/MPxCommand.h>
+#include <maya/MSyntax.h>
+#include <maya/MArgList.h>
+#include <maya/MArgDatabase.h>
+#include <maya/MPoint.h>
+#include <maya/MPointArray.h>
+#include <maya/MFnNurbsCurve.h>
+#include <maya/MDagModifier.h>
 
 #include <fstream>
 #include <iostream>
@@ -80,114 +90,123 @@
 #include <stdlib.h>
 #include <ios>
 #include <vector>
-#include <deque>
 #include <map>
-
-#define M_PI 3.14159265359
-
-std::map<std::string, MString> correspondanceStrToMString = {
-    {"Xposition" , MString("translateX")},
-    {"Yposition" , MString("translateY")},
-    {"Zposition" , MString("translateZ")},
-    {"Xrotation" , MString("rotateX")},
-    {"Yrotation" , MString("rotateY")},
-    {"Zrotation" , MString("rotateZ")}
-};
-
-std::map<std::string, float> conversionDegToRad = {
-    {"Xposition" , 1.0},
-    {"Yposition" , 1.0},
-    {"Zposition" , 1.0},
-    {"Xrotation" , M_PI/180.0},
-    {"Yrotation" , M_PI/180.0},
-    {"Zrotation" , M_PI/180.0}
-};
-
-class Node {
-private:
-public:
-    std::string name;
-    float offset[3];
-    std::vector<std::string> channels;
-    MObject jointObj;
-    MObject animCurveObj;
-
-    Node* parent = nullptr;
-    std::vector<Node*> children = std::vector<Node*>();
-    std::vector<std::vector<double>> channelValues = std::vector< std::vector<double>>();
-    Node();
-    Node(std::string name, float offset[3], std::vector<std::string> channels);
-    ~Node();
-
-    void mayaCreate();
-};
-
-Node::Node(){}
-
-Node::Node(std::string name, float offset[3], std::vector<std::string> channels) {
-    this->name = name;
-    this->offset[0] = offset[0];
-    this->offset[1] = offset[1];
-    this->offset[2] = offset[2];
-    this->channels = channels;
+#include <memory>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "clip.h"
+#include "asfAmcTranslator.h"
+
+// The imported clips are released when a scene is created or opened
+MCallbackIdArray sceneCallbacks;
+
+static void releaseClips(void*) {
+    importedClips.clear();
 }
 
-Node::~Node() {}
+static bool isBlank(const char* begin, const char* end) {
+    for (const char* p = begin; p < end; p++) {
+        if (*p != ' ' && *p != '\t' && *p != '\r') {
+            return false;
+        }
+    }
+    return true;
+}
 
-void Node::mayaCreate(){
-    MFnIkJoint jointFn;
-    if (parent) {
-        jointObj = jointFn.create(parent->jointObj);
+// Splits text in non blank lines and decodes lines [0, nbFrames) into the
+// rows starting at firstFrame, in parallel.
+template <typename T>
+static bool decodeFrames(const char* text, const char* textEnd, MotionMatrix& motion,
+                         int firstFrame, int nbFrames, int nbThreads) {
+    std::vector<const char*> lineBegins;
+    std::vector<const char*> lineEnds;
+    lineBegins.reserve(nbFrames);
+    lineEnds.reserve(nbFrames);
+    const char* p = text;
+    while (p < textEnd && (int)lineBegins.size() < nbFrames) {
+        const char* lineEnd = (const char*)std::memchr(p, '\n', textEnd - p);
+        if (!lineEnd) {
+            lineEnd = textEnd;
+        }
+        if (!isBlank(p, lineEnd)) {
+            lineBegins.push_back(p);
+            lineEnds.push_back(lineEnd);
+        }
+        p = lineEnd + 1;
     }
-    else {
-        jointObj = jointFn.create();
+    if ((int)lineBegins.size() < nbFrames) {
+        return false;
     }
-    MString nameMString(name.c_str());
-    jointFn.setName(nameMString);
-    MVector translation(offset);
-    jointFn.setTranslation(translation, MSpace::kObject);
-    
-    MGlobal::clearSelectionList();
-    MSelectionList sList;
-
-    sList.add(nameMString);
-
-    MGlobal::setActiveSelectionList(sList);
-
-    MItSelectionList iter(sList);
-
-    MDagPath mObject;
-    MObject mComponent;
-
-        //for (; iter.isDone(); iter.next()) {
-
-            iter.getDagPath(mObject, mComponent);
-
-            MFnDagNode fnSet(mObject);
-
-            for (int channelIndex = 0; channelIndex < channels.size(); channelIndex++) {
-                MString channelName = correspondanceStrToMString[channels[channelIndex]];
-                double conversion = conversionDegToRad[channels[channelIndex]];
 
+    std::atomic<bool> valid(true);
+    parallelFor(nbFrames, nbThreads, [&](int begin, int end) {
+        for (int i = begin; i < end && valid; i++) {
+            if (!decodeFrame(lineBegins[i], lineEnds[i], motion.row<T>(firstFrame + i), motion.nbChannels)) {
+                valid = false;
+            }
+        }
+    });
+    return valid;
+}
 
-                const MObject channel = fnSet.attribute(channelName);
-
-                MFnAnimCurve acFnSet;
-                acFnSet.create(mObject.transform(), channel);
-
-                for (int frameIndex = 0; frameIndex < channelValues.size(); frameIndex++) {
-                    acFnSet.addKeyframe(channelValues[frameIndex][0], channelValues[frameIndex][channelIndex + 1]*conversion);
+// Reads the MOTION values of every frame, input being positioned right after
+// the frame time of the header.
+template <typename T>
+static bool readMotion(std::istream& input, MotionMatrix& motion, const ImportPlan& plan,
+                       unsigned long long fileSize) {
+    if (!plan.fastTokenizer) {
+        std::string currentToken;
+        for (int i = 0; i < motion.nbFrames; i++) {
+            T* row = motion.row<T>(i);
+            for (int channelIndex = 0; channelIndex < motion.nbChannels; channelIndex++) {
+                if (!(input >> currentToken)) {
+                    return false;
                 }
-
+                row[channelIndex] = (T)std::stod(currentToken);
             }
-        //}
-
-    for (Node* child : children) {
-        child->mayaCreate();
+        }
+        return true;
     }
-}
 
+    if (!plan.stream) {
+        std::string text(fileSize - (unsigned long long)input.tellg(), '\0');
+        input.read(&text[0], text.size());
+        text.resize(input.gcount());
+        return decodeFrames<T>(text.data(), text.data() + text.size(), motion, 0, motion.nbFrames, plan.nbThreads);
+    }
 
+    // Only one block of text is held at a time, each decoded in parallel
+    const int blockFrames = 1024 * plan.nbThreads;
+    std::string block;
+    std::string line;
+    std::getline(input, line);
+    for (int firstFrame = 0; firstFrame < motion.nbFrames; firstFrame += blockFrames) {
+        int nbFrames = std::min(blockFrames, motion.nbFrames - firstFrame);
+        int nbLines = 0;
+        block.clear();
+        while (nbLines < nbFrames && std::getline(input, line)) {
+            if (isBlank(line.data(), line.data() + line.size())) {
+                continue;
+            }
+            block += line;
+            block += '\n';
+            nbLines++;
+        }
+        if (nbLines < nbFrames) {
+            return false;
+        }
+        if (!decodeFrames<T>(block.data(), block.data() + block.size(), motion, firstFrame, nbFrames, plan.nbThreads)) {
+            return false;
+        }
+    }
+    return true;
+}
 
 //This is the backbone for creating a MPxFileTranslator
 class BvhTranslator : public MPxFileTranslator {
@@ -239,9 +258,7 @@ public:
                                         const MString& optionsString,
                             MPxFileTranslator::FileAccessMode mode) override;
 
-    bool readNode(Node& node, std::istringstream& tokens);
-
-    bool readAnimNode(Node& node, std::istringstream& tokens, double currentTime);
+    bool readNode(Node& node, std::istream& tokens);
 
 private:
 };
@@ -265,18 +282,23 @@ MStatus BvhTranslator::reader ( const MFileObject& file,
 
     MStatus rval(MS::kSuccess);
 
-    std::ifstream inputfile(fname.asChar(), std::ios::in);
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    // Binary mode keeps tellg consistent with the number of bytes read
+    std::ifstream inputfile(fname.asChar(), std::ios::in | std::ios::binary);
     if (!inputfile) {
         // open failed
         std::cerr << fname << ": could not be opened for reading\n";
         return MS::kFailure;
     }
 
-    std::stringstream buffer;
-    buffer << inputfile.rdbuf();
-    std::string content = buffer.str();
+    inputfile.seekg(0, std::ios::end);
+    unsigned long long fileSize = inputfile.tellg();
+    inputfile.seekg(0, std::ios::beg);
 
-    std::istringstream tokens(content);
+    // The header is read token by token straight from the file, the motion
+    // is then read according to the import plan.
+    std::istream& tokens = inputfile;
 
     std::string currentToken;
 
@@ -288,32 +310,39 @@ MStatus BvhTranslator::reader ( const MFileObject& file,
 
     tokens >> currentToken;
 
-    std::vector<Node*> rootVect;
-    std::deque<Node*> nodeQueue;
+    std::unique_ptr<Clip> clip(new Clip());
+    clip->file = fname;
+    std::vector<Node>& skeleton = clip->skeleton;
+    // Indices of the joints whose block is still open, innermost last
+    std::vector<int> openNodes;
 
     while (currentToken.compare("ROOT") == 0) {
-        Node* root = new Node();
-        bool state = readNode(*root, tokens);
+        skeleton.emplace_back();
+        bool state = readNode(skeleton.back(), tokens);
         if (!state) {
             return MS::kFailure;
         }
-        rootVect.push_back(root);
-        nodeQueue.push_back(root);
-        while (!nodeQueue.empty()) {
+        openNodes.push_back(skeleton.size() - 1);
+        while (!openNodes.empty()) {
             tokens >> currentToken;
             if (currentToken.compare("JOINT") == 0) {
-                Node* node = new Node();
-                bool state = readNode(*node, tokens);
+                skeleton.emplace_back();
+                bool state = readNode(skeleton.back(), tokens);
                 if (!state) {
                     return MS::kFailure;
                 }
-                nodeQueue.back()->children.push_back(node);
-                node->parent = nodeQueue.back();
-                nodeQueue.push_back(node);
+                skeleton.back().parent = openNodes.back();
+                openNodes.push_back(skeleton.size() - 1);
             }
             else if (currentToken.compare("End") == 0) {
-                Node* node = new Node();
-                tokens >> node->name;
+                skeleton.emplace_back();
+                Node& node = skeleton.back();
+                node.parent = openNodes.back();
+                // Every end site is called "Site" in the file. Name it after its
+                // joint instead so that Maya does not have to resolve thousands
+                // of clashing names on large skeletons.
+                tokens >> currentToken;
+                node.name = skeleton[node.parent].name + "_end";
                 tokens >> currentToken;
                 if (currentToken.compare("{") != 0) {
                     std::cerr << "Error in file content with tokens\n";
@@ -326,10 +355,8 @@ MStatus BvhTranslator::reader ( const MFileObject& file,
                 }
                 for (int i = 0; i < 3; i++) {
                     tokens >> currentToken;
-                    node->offset[i] = std::stof(currentToken);
+                    node.offset[i] = std::stof(currentToken);
                 }
-                nodeQueue.back()->children.push_back(node);
-                node->parent = nodeQueue.back();
                 tokens >> currentToken;
                 if (currentToken.compare("}") != 0) {
                     std::cerr << "Error in file content with tokens\n";
@@ -337,7 +364,7 @@ MStatus BvhTranslator::reader ( const MFileObject& file,
                 }
             }
             else if (currentToken.compare("}") == 0) {
-                nodeQueue.pop_back();
+                openNodes.pop_back();
             }
             else {
                 std::cerr << "Error in file content with tokens\n";
@@ -381,41 +408,41 @@ MStatus BvhTranslator::reader ( const MFileObject& file,
 
     double timeFrame = std::stod(currentToken);
 
-    double time = 0;
+    // The cleanup and the index convert durations to frames with it
+    if (!std::isfinite(timeFrame) || timeFrame <= 0.0) {
+        std::cerr << fname << ": the frame time must be positive\n";
+        return MS::kFailure;
+    }
 
-    nodeQueue.clear();
+    int nbChannels = compileClip(*clip);
 
-    for (int i = 0; i < nbFrames; i++) {
-        for (Node* root : rootVect) {
-            nodeQueue.push_back(root);
-            while (!nodeQueue.empty()) {
-                Node* node = nodeQueue.back();
-                nodeQueue.pop_back();
-                bool state = readAnimNode(*node, tokens, time);
-                if (!state) {
-                    return MS::kFailure;
-                }
-                for (int childIndex = node->children.size() - 1; childIndex >= 0; childIndex-- ) {
-                    Node* child = node->children[childIndex];
-                    nodeQueue.push_back(child);
-                }
-            }
-        }
-        time += timeFrame;
+    ImportPlan plan;
+    plan.build(fileSize, nbFrames, nbChannels);
+    FootCleanup footCleanup;
+    if (!plan.applyOptions(options) || !footCleanup.applyOptions(options)) {
+        std::cerr << fname << ": invalid import options \"" << options << "\"\n";
+        return MS::kFailure;
     }
 
-    inputfile.close();
+    std::chrono::steady_clock::time_point headerTime = std::chrono::steady_clock::now();
 
-    //Create BVH
-    for (Node* root : rootVect) {
-        root->mayaCreate();
+    MotionMatrix& motion = clip->motion;
+    motion.allocate(nbFrames, nbChannels, timeFrame, plan.singlePrecision);
+    bool state = plan.singlePrecision ? readMotion<float>(inputfile, motion, plan, fileSize)
+                                      : readMotion<double>(inputfile, motion, plan, fileSize);
+    if (!state) {
+        std::cerr << "Error in file content with motion values\n";
+        return MS::kFailure;
     }
 
+    inputfile.close();
+
+    createClip(std::move(clip), plan, footCleanup, startTime, headerTime);
+
     return rval;
 }
 
-
-bool BvhTranslator::readNode(Node& node, std::istringstream& tokens) {
+bool BvhTranslator::readNode(Node& node, std::istream& tokens) {
     tokens >> node.name;
     std::string currentToken;
     tokens >> currentToken;
@@ -450,26 +477,6 @@ bool BvhTranslator::readNode(Node& node, std::istringstream& tokens) {
 
 }
 
-bool BvhTranslator::readAnimNode(Node& node, std::istringstream& tokens, double currentTime) {
-
-    if (node.channels.empty()) {
-        return true;
-    }
-    int nbChannels = node.channels.size();
-
-    std::vector<double> frameChannelsValues;
-    frameChannelsValues.push_back(currentTime); // Add the currentTime at the beginning of the vector
-
-    std::string currentToken;
-    for (int i = 0; i < nbChannels; i++) {
-        tokens >> currentToken;
-        frameChannelsValues.push_back(std::stod(currentToken));
-    }
-    node.channelValues.push_back(frameChannelsValues);
-
-    return true;
-}
-
 // Whenever Maya needs to know the preferred extension of this file format,
 // it calls this method. For example, if the user tries to save a file called
 // "test" using the Save As dialog, Maya will call this method and actually
@@ -480,7 +487,6 @@ MString BvhTranslator::defaultExtension () const
     return "bvh";
 }
 
-
 //This method is pretty simple, maya will call this function
 //to make sure it is really a file from our translator.
 //To make sure, we have a little magic number and we verify against it.
@@ -489,10 +495,375 @@ MPxFileTranslator::MFileKind BvhTranslator::identifyFile (
                                         const char* buffer,
                                         short size) const
 {
-    // Check the buffer for the "BVH" magic number, the
-    // string "<BVH>\n"
+    // A BVH file starts with the "HIERARCHY" keyword. Checking it keeps the
+    // translator from claiming the files of the AsfAmc translator.
+    const char* keyword = "HIERARCHY";
+    short length = (short)std::strlen(keyword);
+    short i = 0;
+    while (i < size && std::isspace((unsigned char)buffer[i])) {
+        i++;
+    }
+    if (size - i < length) {
+        return kCouldBeMyFileType;
+    }
+    return std::strncmp(buffer + i, keyword, length) == 0 ? kIsMyFileType : kNotMyFileType;
+}
+
+// Ramer-Douglas-Peucker simplification of a polyline of nbPoints x, y, z
+// points. Returns the indices of the points kept, every dropped point being
+// closer than tolerance to the simplified polyline.
+static std::vector<int> decimate(const double* points, int nbPoints, double tolerance) {
+    std::vector<char> kept(nbPoints, 0);
+    kept[0] = 1;
+    kept[nbPoints - 1] = 1;
+    std::vector<std::pair<int, int>> ranges;
+    ranges.push_back(std::make_pair(0, nbPoints - 1));
+    while (!ranges.empty()) {
+        int first = ranges.back().first;
+        int last = ranges.back().second;
+        ranges.pop_back();
+        const double* a = points + 3 * first;
+        const double* b = points + 3 * last;
+        double ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        double abLength2 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+        double maxDistance2 = tolerance * tolerance;
+        int farthest = -1;
+        for (int i = first + 1; i < last; i++) {
+            const double* p = points + 3 * i;
+            double ap[3] = { p[0] - a[0], p[1] - a[1], p[2] - a[2] };
+            double t = abLength2 > 0.0 ? (ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2]) / abLength2 : 0.0;
+            t = std::max(0.0, std::min(1.0, t));
+            double d[3] = { ap[0] - t * ab[0], ap[1] - t * ab[1], ap[2] - t * ab[2] };
+            double distance2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            if (distance2 > maxDistance2) {
+                maxDistance2 = distance2;
+                farthest = i;
+            }
+        }
+        if (farthest >= 0) {
+            kept[farthest] = 1;
+            ranges.push_back(std::make_pair(first, farthest));
+            ranges.push_back(std::make_pair(farthest, last));
+        }
+    }
+    std::vector<int> indices;
+    for (int i = 0; i < nbPoints; i++) {
+        if (kept[i]) {
+            indices.push_back(i);
+        }
+    }
+    return indices;
+}
+
+// Creates the motion trail of each selected joint of an imported clip as a
+// linear NURBS curve. The joint positions come from the batch evaluation of
+// the parsed clip, not from the Maya scene, so long takes are fast.
+//
+//    bvhMotionTrail [-startFrame int] [-endFrame int] [-tolerance double] [joints]
+//
+// Frames are indices in the clip, the whole clip by default. With a
+// tolerance, points closer than it to the simplified trail are dropped.
+// Returns the names of the curves.
+class BvhMotionTrailCmd : public MPxCommand {
+public:
+    MStatus doIt(const MArgList& args) override;
+    MStatus redoIt() override;
+    MStatus undoIt() override;
+    bool isUndoable() const override;
+
+    static void* creator();
+    static MSyntax newSyntax();
+
+private:
+    // Trails computed by doIt, their curves are created by redoIt and
+    // deleted by undoIt
+    std::vector<MPointArray> trailCvs;
+    std::vector<MString> trailNames;
+    std::vector<MObject> trailCurves;
+};
+
+void* BvhMotionTrailCmd::creator()
+{
+    return new BvhMotionTrailCmd();
+}
 
-    return kIsMyFileType;
+MSyntax BvhMotionTrailCmd::newSyntax()
+{
+    MSyntax syntax;
+    syntax.addFlag("-s", "-startFrame", MSyntax::kLong);
+    syntax.addFlag("-e", "-endFrame", MSyntax::kLong);
+    syntax.addFlag("-t", "-tolerance", MSyntax::kDouble);
+    syntax.useSelectionAsDefault(true);
+    syntax.setObjectType(MSyntax::kSelectionList, 1);
+    return syntax;
+}
+
+MStatus BvhMotionTrailCmd::doIt(const MArgList& args)
+{
+    MStatus status;
+    MArgDatabase argData(syntax(), args, &status);
+    if (!status) {
+        return status;
+    }
+
+    int startFrame = 0;
+    int endFrame = -1;
+    double tolerance = 0.0;
+    if (argData.isFlagSet("-startFrame")) {
+        argData.getFlagArgument("-startFrame", 0, startFrame);
+    }
+    if (argData.isFlagSet("-endFrame")) {
+        argData.getFlagArgument("-endFrame", 0, endFrame);
+    }
+    if (argData.isFlagSet("-tolerance")) {
+        argData.getFlagArgument("-tolerance", 0, tolerance);
+    }
+
+    MSelectionList selection;
+    argData.getObjects(selection);
+
+    // Group the selected joints by clip, so that each clip is evaluated once
+    std::map<const Clip*, std::vector<int>> clipJoints;
+    for (unsigned int i = 0; i < selection.length(); i++) {
+        MDagPath path;
+        selection.getDagPath(i, path);
+        int joint = -1;
+        for (const std::unique_ptr<Clip>& clip : importedClips) {
+            joint = clip->findJoint(path.node());
+            if (joint >= 0) {
+                clipJoints[clip.get()].push_back(joint);
+                break;
+            }
+        }
+        if (joint < 0) {
+            displayWarning(path.partialPathName() + " is not a joint of an imported BVH clip");
+        }
+    }
+
+    for (const std::pair<const Clip* const, std::vector<int>>& entry : clipJoints) {
+        const Clip& clip = *entry.first;
+        const std::vector<int>& joints = entry.second;
+
+        int firstFrame = std::max(0, startFrame);
+        int lastFrame = endFrame < 0 ? clip.motion.nbFrames - 1 : std::min(endFrame, clip.motion.nbFrames - 1);
+        int nbFrames = lastFrame - firstFrame + 1;
+        if (nbFrames < 2) {
+            displayError("bvhMotionTrail: the frame range holds less than two frames");
+            return MS::kFailure;
+        }
+
+        std::vector<double> positions;
+        computeWorldPositions(clip, firstFrame, lastFrame, joints, std::thread::hardware_concurrency(), positions);
+
+        std::vector<double> trail(3 * nbFrames);
+        for (size_t j = 0; j < joints.size(); j++) {
+            for (int i = 0; i < nbFrames; i++) {
+                std::memcpy(&trail[3 * i], &positions[((size_t)i * joints.size() + j) * 3], 3 * sizeof(double));
+            }
+
+            std::vector<int> indices;
+            if (tolerance > 0.0) {
+                indices = decimate(trail.data(), nbFrames, tolerance);
+            }
+            else {
+                indices.resize(nbFrames);
+                for (int i = 0; i < nbFrames; i++) {
+                    indices[i] = i;
+                }
+            }
+
+            MPointArray cvs;
+            cvs.setLength(indices.size());
+            for (size_t k = 0; k < indices.size(); k++) {
+                const double* p = &trail[3 * indices[k]];
+                cvs[k] = MPoint(p[0], p[1], p[2]);
+            }
+            trailCvs.push_back(cvs);
+            trailNames.push_back(MString(clip.skeleton[joints[j]].name.c_str()));
+        }
+    }
+
+    // Every range is valid, nothing was created before this point
+    return redoIt();
+}
+
+MStatus BvhMotionTrailCmd::redoIt()
+{
+    MStatus status;
+    clearResult();
+    for (size_t i = 0; i < trailCvs.size(); i++) {
+        // Degree 1 curve: one knot per CV
+        MDoubleArray knots(trailCvs[i].length());
+        for (unsigned int k = 0; k < knots.length(); k++) {
+            knots[k] = (double)k;
+        }
+
+        MFnNurbsCurve curveFn;
+        MObject parentObj;
+        MObject curveObj = curveFn.create(trailCvs[i], knots, 1, MFnNurbsCurve::kOpen, false, false, parentObj, &status);
+        if (!status) {
+            displayError("bvhMotionTrail: could not create the curve of " + trailNames[i]);
+            undoIt();
+            return status;
+        }
+        trailCurves.push_back(curveObj);
+        MFnDagNode curveTransformFn(curveObj);
+        appendToResult(curveTransformFn.setName(trailNames[i] + "Trail"));
+    }
+
+    return MS::kSuccess;
+}
+
+// Deletes the transforms of the curves, which deletes their shapes
+MStatus BvhMotionTrailCmd::undoIt()
+{
+    MDagModifier dagModifier;
+    for (const MObject& curveObj : trailCurves) {
+        dagModifier.deleteNode(curveObj);
+    }
+    trailCurves.clear();
+    return dagModifier.doIt();
+}
+
+bool BvhMotionTrailCmd::isUndoable() const
+{
+    return !trailCurves.empty();
+}
+
+// Searches the trajectory index for the windows whose root path looks like
+// a described one, and manages the files of the motion library.
+//
+//    bvhTrajectorySearch -turn double -startSpeed double [-endSpeed double]
+//                        [-count int] [-headingWeight double] [-speedWeight double]
+//    bvhTrajectorySearch -addFile string | -removeFile string | -clear
+//
+// The described path lasts the window of the index (2 s), turns by -turn
+// degrees (positive to the left) and its speed goes from -startSpeed to
+// -endSpeed (same as -startSpeed by default) in file units per second, a
+// negative speed moving backward: "-turn 90 -startSpeed 300" runs into a
+// left turn, "-startSpeed 150 -endSpeed -150" stops and reverses. Returns
+// "file startFrame endFrame distance" for the -count (10) best windows.
+//
+// Imported clips are indexed as they are imported. -addFile indexes a BVH or
+// AMC file without creating its joints, -removeFile drops a file from the
+// index. These return the number of windows in the index.
+class BvhTrajectorySearchCmd : public MPxCommand {
+public:
+    MStatus doIt(const MArgList& args) override;
+
+    static void* creator();
+    static MSyntax newSyntax();
+};
+
+void* BvhTrajectorySearchCmd::creator()
+{
+    return new BvhTrajectorySearchCmd();
+}
+
+MSyntax BvhTrajectorySearchCmd::newSyntax()
+{
+    MSyntax syntax;
+    syntax.addFlag("-t", "-turn", MSyntax::kDouble);
+    syntax.addFlag("-ss", "-startSpeed", MSyntax::kDouble);
+    syntax.addFlag("-es", "-endSpeed", MSyntax::kDouble);
+    syntax.addFlag("-c", "-count", MSyntax::kLong);
+    syntax.addFlag("-hw", "-headingWeight", MSyntax::kDouble);
+    syntax.addFlag("-sw", "-speedWeight", MSyntax::kDouble);
+    syntax.addFlag("-af", "-addFile", MSyntax::kString);
+    syntax.addFlag("-rf", "-removeFile", MSyntax::kString);
+    syntax.addFlag("-cl", "-clear");
+    return syntax;
+}
+
+MStatus BvhTrajectorySearchCmd::doIt(const MArgList& args)
+{
+    MStatus status;
+    MArgDatabase argData(syntax(), args, &status);
+    if (!status) {
+        return status;
+    }
+
+    if (argData.isFlagSet("-clear")) {
+        trajectoryIndex.clear();
+    }
+    if (argData.isFlagSet("-removeFile")) {
+        MString fileName;
+        argData.getFlagArgument("-removeFile", 0, fileName);
+        // Windows are indexed under the expanded name, as -addFile resolves it
+        MFileObject file;
+        file.setRawFullName(fileName);
+        trajectoryIndex.remove(file.expandedFullName());
+    }
+    if (argData.isFlagSet("-addFile")) {
+        MString fileName;
+        argData.getFlagArgument("-addFile", 0, fileName);
+        MFileObject file;
+        file.setRawFullName(fileName);
+        std::string name(fileName.asChar());
+        bool amc = name.size() > 4 && name.compare(name.size() - 4, 4, ".amc") == 0;
+        if (amc) {
+            status = AsfAmcTranslator().reader(file, "scene=0", MPxFileTranslator::kImportAccessMode);
+        }
+        else {
+            status = BvhTranslator().reader(file, "scene=0", MPxFileTranslator::kImportAccessMode);
+        }
+        if (!status) {
+            displayError("bvhTrajectorySearch: could not index " + fileName);
+            return status;
+        }
+    }
+
+    if (!argData.isFlagSet("-turn") && !argData.isFlagSet("-startSpeed")) {
+        setResult(trajectoryIndex.nbWindows());
+        return MS::kSuccess;
+    }
+
+    double turn = 0.0;
+    double startSpeed = 0.0;
+    int count = 10;
+    double headingWeight = 20.0;
+    double speedWeight = 0.5;
+    if (argData.isFlagSet("-turn")) {
+        argData.getFlagArgument("-turn", 0, turn);
+    }
+    if (argData.isFlagSet("-startSpeed")) {
+        argData.getFlagArgument("-startSpeed", 0, startSpeed);
+    }
+    double endSpeed = startSpeed;
+    if (argData.isFlagSet("-endSpeed")) {
+        argData.getFlagArgument("-endSpeed", 0, endSpeed);
+    }
+    if (argData.isFlagSet("-count")) {
+        argData.getFlagArgument("-count", 0, count);
+    }
+    if (argData.isFlagSet("-headingWeight")) {
+        argData.getFlagArgument("-headingWeight", 0, headingWeight);
+    }
+    if (argData.isFlagSet("-speedWeight")) {
+        argData.getFlagArgument("-speedWeight", 0, speedWeight);
+    }
+    if (count <= 0) {
+        displayError("bvhTrajectorySearch: -count must be positive");
+        return MS::kFailure;
+    }
+
+    float features[TrajectoryIndex::kFeatures];
+    TrajectoryIndex::pathFeatures(turn, startSpeed, endSpeed, features);
+
+    MStringArray result;
+    for (const TrajectoryIndex::Match& match : trajectoryIndex.query(features, count, headingWeight, speedWeight)) {
+        MString line(match.file);
+        line += " ";
+        line += match.startFrame;
+        line += " ";
+        line += match.endFrame;
+        line += " ";
+        line += match.distance;
+        result.append(line);
+    }
+    setResult(result);
+
+    return MS::kSuccess;
 }
 
 MStatus initializePlugin( MObject obj )
@@ -516,6 +887,36 @@ MStatus initializePlugin( MObject obj )
         return status;
     }
 
+    status =  plugin.registerFileTranslator( "AsfAmc",
+                                        "bvhTranslator.rgb",
+                                        AsfAmcTranslator::creator);
+    if (!status)
+    {
+        status.perror("registerFileTranslator");
+        return status;
+    }
+
+    status = plugin.registerCommand( "bvhMotionTrail",
+                                     BvhMotionTrailCmd::creator,
+                                     BvhMotionTrailCmd::newSyntax);
+    if (!status)
+    {
+        status.perror("registerCommand");
+        return status;
+    }
+
+    status = plugin.registerCommand( "bvhTrajectorySearch",
+                                     BvhTrajectorySearchCmd::creator,
+                                     BvhTrajectorySearchCmd::newSyntax);
+    if (!status)
+    {
+        status.perror("registerCommand");
+        return status;
+    }
+
+    sceneCallbacks.append(MSceneMessage::addCallback(MSceneMessage::kBeforeNew, releaseClips));
+    sceneCallbacks.append(MSceneMessage::addCallback(MSceneMessage::kBeforeOpen, releaseClips));
+
     return status;
 }
 
@@ -531,6 +932,32 @@ MStatus uninitializePlugin( MObject obj )
         return status;
     }
 
+    status =  plugin.deregisterFileTranslator( "AsfAmc" );
+    if (!status)
+    {
+        status.perror("deregisterFileTranslator");
+        return status;
+    }
+
+    status = plugin.deregisterCommand( "bvhMotionTrail" );
+    if (!status)
+    {
+        status.perror("deregisterCommand");
+        return status;
+    }
+
+    status = plugin.deregisterCommand( "bvhTrajectorySearch" );
+    if (!status)
+    {
+        status.perror("deregisterCommand");
+        return status;
+    }
+
+    MMessage::removeCallbacks(sceneCallbacks);
+    sceneCallbacks.clear();
+    importedClips.clear();
+    trajectoryIndex.clear();
+
     return status;
 }
 
@@ -0,0 +1,1105 @@
+// Clips shared by the translators and the commands, see clip.h
+
+#include "clip.h"
+
+#include <maya/MGlobal.h>
+#include <maya/MStringArray.h>
+#include <maya/MVector.h>
+#include <maya/MPlug.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MFnIkJoint.h>
+#include <maya/MFnAnimCurve.h>
+#include <maya/MTime.h>
+#include <maya/MTimeArray.h>
+#include <maya/MDoubleArray.h>
+#include <maya/MTransformationMatrix.h>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+std::map<std::string, MString> correspondanceStrToMString = {
+    {"Xposition" , MString("translateX")},
+    {"Yposition" , MString("translateY")},
+    {"Zposition" , MString("translateZ")},
+    {"Xrotation" , MString("rotateX")},
+    {"Yrotation" , MString("rotateY")},
+    {"Zrotation" , MString("rotateZ")}
+};
+
+std::map<std::string, int> correspondanceStrToChannelType = {
+    {"Xposition" , kPositionX},
+    {"Yposition" , kPositionY},
+    {"Zposition" , kPositionZ},
+    {"Xrotation" , kRotationX},
+    {"Yrotation" , kRotationY},
+    {"Zrotation" , kRotationZ}
+};
+
+// Maya applies the rotations of an "xyz" joint as X, then Y, then Z, the
+// reverse of the BVH channel order: "Zrotation Yrotation Xrotation" is "xyz".
+std::map<std::string, MTransformationMatrix::RotationOrder> correspondanceStrToRotationOrder = {
+    {"ZYX" , MTransformationMatrix::kXYZ},
+    {"XZY" , MTransformationMatrix::kYZX},
+    {"YXZ" , MTransformationMatrix::kZXY},
+    {"YZX" , MTransformationMatrix::kXZY},
+    {"ZXY" , MTransformationMatrix::kYXZ},
+    {"XYZ" , MTransformationMatrix::kZYX}
+};
+
+std::map<std::string, float> conversionDegToRad = {
+    {"Xposition" , 1.0},
+    {"Yposition" , 1.0},
+    {"Zposition" , 1.0},
+    {"Xrotation" , M_PI/180.0},
+    {"Yrotation" , M_PI/180.0},
+    {"Zrotation" , M_PI/180.0}
+};
+
+template <>
+float* MotionMatrix::row<float>(int frame) { return floatValues.data() + (size_t)frame * nbChannels; }
+
+template <>
+double* MotionMatrix::row<double>(int frame) { return doubleValues.data() + (size_t)frame * nbChannels; }
+
+void MotionMatrix::allocate(int nbFrames, int nbChannels, double frameTime, bool singlePrecision) {
+    this->nbFrames = nbFrames;
+    this->nbChannels = nbChannels;
+    this->frameTime = frameTime;
+    this->singlePrecision = singlePrecision;
+    floatValues.clear();
+    doubleValues.clear();
+    if (singlePrecision) {
+        floatValues.resize((size_t)nbFrames * nbChannels);
+    }
+    else {
+        doubleValues.resize((size_t)nbFrames * nbChannels);
+    }
+}
+
+void MotionMatrix::resizeFrames(int nbFrames) {
+    this->nbFrames = nbFrames;
+    if (singlePrecision) {
+        floatValues.resize((size_t)nbFrames * nbChannels);
+    }
+    else {
+        doubleValues.resize((size_t)nbFrames * nbChannels);
+    }
+}
+
+Node::Node(){}
+
+Node::Node(std::string name, float offset[3], std::vector<std::string> channels) {
+    this->name = name;
+    this->offset[0] = offset[0];
+    this->offset[1] = offset[1];
+    this->offset[2] = offset[2];
+    this->channels = channels;
+}
+
+Node::~Node() {}
+
+// Creates the joint and its animation curves. The parent joint must already
+// exist, which is guaranteed when the skeleton is created in vector order.
+void Node::mayaCreate(const std::vector<Node>& skeleton, const MotionMatrix& motion){
+    MFnIkJoint jointFn;
+    if (parent >= 0) {
+        jointObj = jointFn.create(skeleton[parent].jointObj);
+    }
+    else {
+        jointObj = jointFn.create();
+    }
+    MString nameMString(name.c_str());
+    jointFn.setName(nameMString);
+    MVector translation(offset);
+    jointFn.setTranslation(translation, MSpace::kObject);
+
+    // Match the rotation order of the channels so that the joint evaluates
+    // like the file, and like the batch evaluation of the clip.
+    std::string rotationAxes;
+    for (const std::string& channel : channels) {
+        if (channel.compare(1, std::string::npos, "rotation") == 0) {
+            rotationAxes += channel[0];
+        }
+    }
+    if (correspondanceStrToRotationOrder.count(rotationAxes)) {
+        jointFn.setRotationOrder(correspondanceStrToRotationOrder[rotationAxes], false);
+    }
+
+    if (channels.empty()) {
+        return;
+    }
+
+    // Connect the curves to the plugs of the joint we just created. A lookup
+    // by name scans the scene and is ambiguous as soon as two joints share a
+    // name, and a DAG path costs the depth of the joint.
+    MFnDependencyNode fnSet(jointObj);
+
+    MTimeArray times;
+    times.setLength(motion.nbFrames);
+    for (int frameIndex = 0; frameIndex < motion.nbFrames; frameIndex++) {
+        times.set(MTime(frameIndex * motion.frameTime), frameIndex);
+    }
+
+    MDoubleArray values;
+    values.setLength(motion.nbFrames);
+
+    for (int channelIndex = 0; channelIndex < channels.size(); channelIndex++) {
+        MString channelName = correspondanceStrToMString[channels[channelIndex]];
+        double conversion = conversionDegToRad[channels[channelIndex]];
+
+        MPlug channel = fnSet.findPlug(channelName, false);
+
+        MFnAnimCurve acFnSet;
+        acFnSet.create(channel);
+
+        for (int frameIndex = 0; frameIndex < motion.nbFrames; frameIndex++) {
+            values[frameIndex] = motion.value(frameIndex, channelOffset + channelIndex)*conversion;
+        }
+        acFnSet.addKeys(&times, &values);
+    }
+}
+
+void CompiledSkeleton::compile(const std::vector<Node>& skeleton) {
+    parents.resize(skeleton.size());
+    offsets.resize(3 * skeleton.size());
+    channelOffsets.resize(skeleton.size());
+    channelCounts.resize(skeleton.size());
+    channelTypes.clear();
+    for (size_t joint = 0; joint < skeleton.size(); joint++) {
+        const Node& node = skeleton[joint];
+        parents[joint] = node.parent;
+        for (int i = 0; i < 3; i++) {
+            offsets[3 * joint + i] = node.offset[i];
+        }
+        channelOffsets[joint] = node.channelOffset;
+        channelCounts[joint] = node.channels.size();
+        for (const std::string& channel : node.channels) {
+            channelTypes.push_back(correspondanceStrToChannelType[channel]);
+        }
+    }
+}
+
+// Fills jointHandles and jointIndices, once the joints of the clip are created
+void Clip::indexJoints() {
+    jointHandles.clear();
+    jointIndices.clear();
+    jointHandles.reserve(skeleton.size());
+    jointIndices.reserve(skeleton.size());
+    for (size_t joint = 0; joint < skeleton.size(); joint++) {
+        jointHandles.push_back(MObjectHandle(skeleton[joint].jointObj));
+        jointIndices.emplace(jointHandles.back().hashCode(), (int)joint);
+    }
+}
+
+// False once every joint of the clip has been deleted
+bool Clip::isAlive() const {
+    for (const MObjectHandle& handle : jointHandles) {
+        if (handle.isValid()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Index of the joint created for jointObj, -1 if it is not part of the clip.
+// Hash codes can collide, and a deleted joint can leave its MObject to a new
+// node, so a candidate must still be valid and hold jointObj.
+int Clip::findJoint(const MObject& jointObj) const {
+    typedef std::unordered_multimap<unsigned int, int>::const_iterator Iterator;
+    std::pair<Iterator, Iterator> candidates = jointIndices.equal_range(MObjectHandle(jointObj).hashCode());
+    for (Iterator it = candidates.first; it != candidates.second; ++it) {
+        const MObjectHandle& handle = jointHandles[it->second];
+        if (handle.isValid() && handle.object() == jointObj) {
+            return it->second;
+        }
+    }
+    return -1;
+}
+
+// Clips imported in the current scene, released when a scene is created or opened
+std::vector<std::unique_ptr<Clip>> importedClips;
+
+static unsigned long long availableMemory() {
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        return status.ullAvailPhys;
+    }
+    return 0;
+#elif defined(_SC_AVPHYS_PAGES)
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || pageSize <= 0) {
+        return 0;
+    }
+    return (unsigned long long)pages * pageSize;
+#else
+    return 0;
+#endif
+}
+
+void ImportPlan::build(unsigned long long fileSize, int nbFrames, int nbChannels) {
+    const unsigned long long MB = 1024ull * 1024ull;
+    unsigned long long memory = availableMemory();
+    unsigned long long matrixSize = (unsigned long long)nbFrames * nbChannels * sizeof(double);
+    unsigned int nbCores = std::thread::hardware_concurrency();
+
+    fastTokenizer = fileSize > 1 * MB;
+    nbThreads = 1;
+    if (fastTokenizer) {
+        nbThreads = (int)std::min<unsigned long long>(std::max(nbCores, 1u), fileSize / (4 * MB) + 1);
+    }
+    // An unknown amount of memory (0) only disables the memory based rules
+    singlePrecision = matrixSize > 256 * MB || (memory && matrixSize > memory / 8);
+    stream = fileSize > 512 * MB || (memory && fileSize + matrixSize > memory / 2);
+}
+
+std::vector<std::pair<MString, MString>> splitOptions(const MString& options) {
+    std::vector<std::pair<MString, MString>> result;
+    MStringArray pairs;
+    options.split(';', pairs);
+    for (unsigned int i = 0; i < pairs.length(); i++) {
+        MStringArray pair;
+        pairs[i].split('=', pair);
+        if (pair.length() == 2) {
+            result.push_back(std::make_pair(pair[0], pair[1]));
+        }
+    }
+    return result;
+}
+
+// Options are given as "name=value" pairs separated by ";", for example
+// file -import -type "Bvh" -options "threads=4;precision=float" "take.bvh";
+// Recognised names are tokenizer (simple, fast), threads (0 keeps the plan),
+// precision (float, double), stream (0, 1), scene (0 only indexes the
+// clip for the trajectory search, without creating joints) and cache (0
+// frees the clip once its keys are created, bvhMotionTrail then ignores its
+// joints).
+bool ImportPlan::applyOptions(const MString& options) {
+    for (const std::pair<MString, MString>& option : splitOptions(options)) {
+        const MString& name = option.first;
+        const MString& value = option.second;
+        if (name == "tokenizer") {
+            if (value == "simple") fastTokenizer = false;
+            else if (value == "fast") fastTokenizer = true;
+            else return false;
+        }
+        else if (name == "threads") {
+            if (!value.isInt() || value.asInt() < 0) return false;
+            if (value.asInt() > 0) nbThreads = value.asInt();
+        }
+        else if (name == "precision") {
+            if (value == "float") singlePrecision = true;
+            else if (value == "double") singlePrecision = false;
+            else return false;
+        }
+        else if (name == "stream") {
+            if (!value.isInt()) return false;
+            stream = value.asInt() != 0;
+        }
+        else if (name == "scene") {
+            if (!value.isInt()) return false;
+            createScene = value.asInt() != 0;
+        }
+        else if (name == "cache") {
+            if (!value.isInt()) return false;
+            cacheClip = value.asInt() != 0;
+        }
+    }
+    // The simple tokenizer reads the file sequentially, token by token from
+    // the stream, without threads or frame blocks
+    if (!fastTokenizer) {
+        nbThreads = 1;
+        stream = false;
+    }
+    return true;
+}
+
+MString ImportPlan::describe() const {
+    MString text;
+    text += fastTokenizer ? "fast tokenizer, " : "simple tokenizer, ";
+    text += nbThreads;
+    text += nbThreads > 1 ? " threads, " : " thread, ";
+    text += singlePrecision ? "float storage, " : "double storage, ";
+    text += stream ? "streamed" : "in memory";
+    if (!createScene) {
+        text += ", index only";
+    }
+    else if (!cacheClip) {
+        text += ", not cached";
+    }
+    return text;
+}
+
+// Rigid transform applied to column vectors, rotation stored row major
+struct RigidTransform {
+    double rotation[9];
+    double translation[3];
+};
+
+// world = parent * local
+static void multiply(const RigidTransform& parent, const RigidTransform& local, RigidTransform& world) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            world.rotation[3 * i + j] = parent.rotation[3 * i] * local.rotation[j]
+                                      + parent.rotation[3 * i + 1] * local.rotation[3 + j]
+                                      + parent.rotation[3 * i + 2] * local.rotation[6 + j];
+        }
+        world.translation[i] = parent.rotation[3 * i] * local.translation[0]
+                             + parent.rotation[3 * i + 1] * local.translation[1]
+                             + parent.rotation[3 * i + 2] * local.translation[2]
+                             + parent.translation[i];
+    }
+}
+
+// Local transform of a joint at a frame, as Maya evaluates the joint created
+// for it: position channels replace the offset and rotations are applied in
+// channel order, the first listed being the outermost.
+static void localTransform(const CompiledSkeleton& skeleton, const MotionMatrix& motion,
+                           int joint, int frame, RigidTransform& local) {
+    static const double identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    std::memcpy(local.rotation, identity, sizeof(identity));
+    for (int i = 0; i < 3; i++) {
+        local.translation[i] = skeleton.offsets[3 * joint + i];
+    }
+    int firstChannel = skeleton.channelOffsets[joint];
+    for (int channel = firstChannel; channel < firstChannel + skeleton.channelCounts[joint]; channel++) {
+        int type = skeleton.channelTypes[channel];
+        double value = motion.value(frame, channel);
+        if (type <= kPositionZ) {
+            local.translation[type - kPositionX] = value;
+            continue;
+        }
+        // local.rotation = local.rotation * R(axis, value)
+        int axis = type - kRotationX;
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        double angle = value * M_PI / 180.0;
+        double c = std::cos(angle);
+        double s = std::sin(angle);
+        for (int row = 0; row < 3; row++) {
+            double a = local.rotation[3 * row + u];
+            double b = local.rotation[3 * row + v];
+            local.rotation[3 * row + u] = a * c + b * s;
+            local.rotation[3 * row + v] = b * c - a * s;
+        }
+    }
+}
+
+// Flags the given joints and all their ancestors, the joints a batch
+// evaluation has to go through to reach them.
+static std::vector<char> neededJoints(const CompiledSkeleton& skeleton, const std::vector<int>& joints) {
+    std::vector<char> needed(skeleton.nbJoints(), 0);
+    for (int joint : joints) {
+        while (joint >= 0 && !needed[joint]) {
+            needed[joint] = 1;
+            joint = skeleton.parents[joint];
+        }
+    }
+    return needed;
+}
+
+// Batch forward kinematics: world transforms of the needed joints at a frame.
+// Parents come first in the skeleton, so a single pass is enough.
+static void evaluateFrame(const CompiledSkeleton& skeleton, const MotionMatrix& motion, int frame,
+                          const std::vector<char>& needed, std::vector<RigidTransform>& world) {
+    world.resize(skeleton.nbJoints());
+    for (int joint = 0; joint < skeleton.nbJoints(); joint++) {
+        if (!needed[joint]) {
+            continue;
+        }
+        int parent = skeleton.parents[joint];
+        if (parent < 0) {
+            localTransform(skeleton, motion, joint, frame, world[joint]);
+        }
+        else {
+            RigidTransform local;
+            localTransform(skeleton, motion, joint, frame, local);
+            multiply(world[parent], local, world[joint]);
+        }
+    }
+}
+
+void computeWorldPositions(const Clip& clip, int firstFrame, int lastFrame, const std::vector<int>& joints,
+                           int nbThreads, std::vector<double>& positions) {
+    int nbFrames = lastFrame - firstFrame + 1;
+    std::vector<char> needed = neededJoints(clip.compiled, joints);
+    positions.resize((size_t)nbFrames * joints.size() * 3);
+    parallelFor(nbFrames, nbThreads, [&](int begin, int end) {
+        std::vector<RigidTransform> world;
+        for (int i = begin; i < end; i++) {
+            evaluateFrame(clip.compiled, clip.motion, firstFrame + i, needed, world);
+            double* framePositions = positions.data() + (size_t)i * joints.size() * 3;
+            for (size_t j = 0; j < joints.size(); j++) {
+                std::memcpy(framePositions + 3 * j, world[joints[j]].translation, 3 * sizeof(double));
+            }
+        }
+    });
+}
+
+void axisAngle(const double axis[3], double angle, double rotation[9]) {
+    double c = std::cos(angle);
+    double s = std::sin(angle);
+    double t = 1.0 - c;
+    double x = axis[0], y = axis[1], z = axis[2];
+    double values[9] = { t * x * x + c,     t * x * y - s * z, t * x * z + s * y,
+                         t * x * y + s * z, t * y * y + c,     t * y * z - s * x,
+                         t * x * z - s * y, t * y * z + s * x, t * z * z + c };
+    std::memcpy(rotation, values, sizeof(values));
+}
+
+void multiply3(const double a[9], const double b[9], double c[9], bool transposeA) {
+    double result[9];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            result[3 * i + j] = 0.0;
+            for (int k = 0; k < 3; k++) {
+                result[3 * i + j] += (transposeA ? a[3 * k + i] : a[3 * i + k]) * b[3 * k + j];
+            }
+        }
+    }
+    std::memcpy(c, result, sizeof(result));
+}
+
+static double length3(const double v[3]) {
+    return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+static void cross3(const double a[3], const double b[3], double c[3]) {
+    double result[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+    std::memcpy(c, result, sizeof(result));
+}
+
+static double angleBetween(const double a[3], const double b[3]) {
+    double axis[3];
+    cross3(a, b, axis);
+    return std::atan2(length3(axis), a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+}
+
+// Columns and axes of the rotation channels of a joint, in channel order.
+// Returns false if the joint does not have three distinct rotation channels.
+static bool rotationChannels(const CompiledSkeleton& skeleton, int joint, int columns[3], int axes[3]) {
+    int nbRotations = 0;
+    int firstChannel = skeleton.channelOffsets[joint];
+    for (int channel = firstChannel; channel < firstChannel + skeleton.channelCounts[joint]; channel++) {
+        if (skeleton.channelTypes[channel] >= kRotationX && nbRotations < 3) {
+            columns[nbRotations] = channel;
+            axes[nbRotations] = skeleton.channelTypes[channel] - kRotationX;
+            nbRotations++;
+        }
+    }
+    return nbRotations == 3 && axes[0] != axes[1] && axes[1] != axes[2] && axes[0] != axes[2];
+}
+
+// A rotation has two Euler solutions, (a, b, c) and (a + 180, 180 - b, c + 180).
+// Replaces angles, in degrees, by the solution nearest to reference, with
+// each angle unwrapped by 360 degrees toward its reference.
+static void nearestEulerSolution(double angles[3], const double reference[3]) {
+    double solutions[2][3] = {
+        { angles[0], angles[1], angles[2] },
+        { angles[0] + 180.0, 180.0 - angles[1], angles[2] + 180.0 }
+    };
+    int best = 0;
+    double bestDistance = std::numeric_limits<double>::max();
+    for (int solution = 0; solution < 2; solution++) {
+        double distance = 0.0;
+        for (int n = 0; n < 3; n++) {
+            double& angle = solutions[solution][n];
+            angle += 360.0 * std::round((reference[n] - angle) / 360.0);
+            distance += (angle - reference[n]) * (angle - reference[n]);
+        }
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = solution;
+        }
+    }
+    std::memcpy(angles, solutions[best], sizeof(solutions[best]));
+}
+
+bool setRotationChannels(const CompiledSkeleton& skeleton, MotionMatrix& motion,
+                         int joint, int frame, const double rotation[9]) {
+    int columns[3];
+    int axes[3];
+    if (!rotationChannels(skeleton, joint, columns, axes)) {
+        return false;
+    }
+
+    // rotation = R(i, a) * R(j, b) * R(k, c), sign is -1 for odd orders
+    int i = axes[0], j = axes[1], k = axes[2];
+    double sign = (j - i + 3) % 3 == 1 ? 1.0 : -1.0;
+    double angles[3];
+    angles[1] = std::asin(std::max(-1.0, std::min(1.0, sign * rotation[3 * i + k])));
+    angles[0] = std::atan2(-sign * rotation[3 * j + k], rotation[3 * k + k]);
+    angles[2] = std::atan2(-sign * rotation[3 * i + j], rotation[3 * i + i]);
+    double original[3];
+    for (int n = 0; n < 3; n++) {
+        angles[n] *= 180.0 / M_PI;
+        original[n] = motion.value(frame, columns[n]);
+    }
+    nearestEulerSolution(angles, original);
+    for (int n = 0; n < 3; n++) {
+        motion.setValue(frame, columns[n], angles[n]);
+    }
+    return true;
+}
+
+void makeEulerContinuous(const CompiledSkeleton& skeleton, MotionMatrix& motion, int joint) {
+    int columns[3];
+    int axes[3];
+    if (!rotationChannels(skeleton, joint, columns, axes) || motion.nbFrames == 0) {
+        return;
+    }
+    double previous[3];
+    for (int n = 0; n < 3; n++) {
+        previous[n] = motion.value(0, columns[n]);
+    }
+    for (int frame = 1; frame < motion.nbFrames; frame++) {
+        double angles[3];
+        for (int n = 0; n < 3; n++) {
+            angles[n] = motion.value(frame, columns[n]);
+        }
+        nearestEulerSolution(angles, previous);
+        for (int n = 0; n < 3; n++) {
+            motion.setValue(frame, columns[n], angles[n]);
+            previous[n] = angles[n];
+        }
+    }
+}
+
+bool FootCleanup::applyOptions(const MString& options) {
+    for (const std::pair<MString, MString>& option : splitOptions(options)) {
+        const MString& name = option.first;
+        const MString& value = option.second;
+        if (name == "footContacts") {
+            MStringArray names;
+            value.split(',', names);
+            for (unsigned int i = 0; i < names.length(); i++) {
+                joints.push_back(names[i].asChar());
+            }
+        }
+        else if (name == "footHeight") {
+            if (!value.isDouble()) return false;
+            heightThreshold = value.asDouble();
+        }
+        else if (name == "footSpeed") {
+            if (!value.isDouble()) return false;
+            speedThreshold = value.asDouble();
+        }
+        else if (name == "footBlend") {
+            if (!value.isDouble()) return false;
+            blendTime = value.asDouble();
+        }
+    }
+    return true;
+}
+
+// First joint of pinned in the subtree of root, other than except, -1 if none
+static int pinnedBelow(const std::vector<int>& parents, const std::vector<int>& pinned, int root, int except) {
+    for (int joint : pinned) {
+        for (int ancestor = joint; ancestor >= 0 && joint != except; ancestor = parents[ancestor]) {
+            if (ancestor == root) {
+                return joint;
+            }
+        }
+    }
+    return -1;
+}
+
+int FootCleanup::run(const Clip& clip, MotionMatrix& motion, int nbThreads) const {
+    const CompiledSkeleton& skeleton = clip.compiled;
+    const std::vector<int>& parents = skeleton.parents;
+
+    // Both joints of the chain are checked before anything is written
+    std::vector<int> feet;
+    for (const std::string& name : joints) {
+        int joint = -1;
+        for (size_t i = 0; i < clip.skeleton.size(); i++) {
+            if (clip.skeleton[i].name == name) {
+                joint = i;
+                break;
+            }
+        }
+        int knee = joint >= 0 ? parents[joint] : -1;
+        int hip = knee >= 0 ? parents[knee] : -1;
+        int columns[3], axes[3];
+        if (hip < 0 || !rotationChannels(skeleton, knee, columns, axes) || !rotationChannels(skeleton, hip, columns, axes)) {
+            MGlobal::displayWarning(MString("bvhTranslator: no two-bone chain with three rotation channels per joint above foot joint ")
+                                    + name.c_str());
+            continue;
+        }
+        if (std::find(feet.begin(), feet.end(), joint) == feet.end()) {
+            feet.push_back(joint);
+        }
+    }
+
+    // A two-bone solve moves every joint below the hip, an aim every joint
+    // below the parent. The joints are sorted from the shallowest, and each
+    // one takes the first solve that moves no joint already pinned.
+    std::vector<int> depths(parents.size(), 0);
+    for (size_t joint = 1; joint < parents.size(); joint++) {
+        depths[joint] = parents[joint] >= 0 ? depths[parents[joint]] + 1 : 0;
+    }
+    std::stable_sort(feet.begin(), feet.end(), [&](int a, int b) { return depths[a] < depths[b]; });
+
+    std::vector<int> pinned;
+    std::vector<char> aims;
+    for (int joint : feet) {
+        int parent = parents[joint];
+        int moved = pinnedBelow(parents, pinned, parents[parent], -1);
+        bool aim = false;
+        if (moved >= 0 && std::find(pinned.begin(), pinned.end(), parent) != pinned.end()) {
+            moved = pinnedBelow(parents, pinned, parent, parent);
+            aim = true;
+        }
+        if (moved >= 0) {
+            MGlobal::displayWarning(MString("bvhTranslator: foot joint ") + clip.skeleton[joint].name.c_str()
+                                    + " is not cleaned, its solve would move foot joint " + clip.skeleton[moved].name.c_str());
+            continue;
+        }
+        pinned.push_back(joint);
+        aims.push_back(aim);
+    }
+
+    int nbCorrected = 0;
+    for (size_t i = 0; i < pinned.size(); i++) {
+        nbCorrected += cleanJoint(clip, motion, pinned[i], aims[i], nbThreads);
+    }
+    return nbCorrected;
+}
+
+int FootCleanup::cleanJoint(const Clip& clip, MotionMatrix& motion, int joint, bool aim, int nbThreads) const {
+    const CompiledSkeleton& skeleton = clip.compiled;
+    int knee = skeleton.parents[joint];
+    int hip = skeleton.parents[knee];
+    int nbFrames = motion.nbFrames;
+    if (nbFrames < 3) {
+        return 0;
+    }
+
+    std::vector<double> positions;
+    computeWorldPositions(clip, 0, nbFrames - 1, std::vector<int>(1, joint), nbThreads, positions);
+
+    double legLength = length3(&skeleton.offsets[3 * knee]) + length3(&skeleton.offsets[3 * joint]);
+    double height = heightThreshold >= 0.0 ? heightThreshold : 0.05 * legLength;
+    double speed = speedThreshold >= 0.0 ? speedThreshold : legLength;
+    double ground = positions[1];
+    for (int frame = 1; frame < nbFrames; frame++) {
+        ground = std::min(ground, positions[3 * frame + 1]);
+    }
+
+    // Contact detection, from the height and the central difference velocity
+    std::vector<char> contact(nbFrames, 0);
+    for (int frame = 0; frame < nbFrames; frame++) {
+        int previous = std::max(frame - 1, 0);
+        int next = std::min(frame + 1, nbFrames - 1);
+        double delta[3];
+        for (int i = 0; i < 3; i++) {
+            delta[i] = positions[3 * next + i] - positions[3 * previous + i];
+        }
+        double velocity = length3(delta) / ((next - previous) * motion.frameTime);
+        contact[frame] = positions[3 * frame + 1] < ground + height && velocity < speed;
+    }
+
+    // Pin of each contact frame, the mean position of its interval. Around an
+    // interval, the weight of its pin eases from 1 to 0 over the blend frames.
+    int blendFrames = std::max(0, (int)std::lround(blendTime / motion.frameTime));
+    std::vector<double> weights(nbFrames, 0.0);
+    std::vector<double> pins(3 * nbFrames);
+    for (int first = 0; first < nbFrames; ) {
+        if (!contact[first]) {
+            first++;
+            continue;
+        }
+        int last = first;
+        while (last + 1 < nbFrames && contact[last + 1]) {
+            last++;
+        }
+        double mean[3] = { 0.0, 0.0, 0.0 };
+        for (int frame = first; frame <= last; frame++) {
+            for (int i = 0; i < 3; i++) {
+                mean[i] += positions[3 * frame + i] / (last - first + 1);
+            }
+        }
+        for (int frame = std::max(first - blendFrames, 0); frame <= std::min(last + blendFrames, nbFrames - 1); frame++) {
+            int gap = std::max(first - frame, frame - last);
+            double weight = 1.0 - (double)std::max(gap, 0) / (blendFrames + 1);
+            weight = weight * weight * (3.0 - 2.0 * weight);
+            if (weight > weights[frame]) {
+                weights[frame] = weight;
+                std::memcpy(&pins[3 * frame], mean, sizeof(mean));
+            }
+        }
+        first = last + 1;
+    }
+
+    // Targets blend the original position toward the pin
+    std::vector<double> targets(3 * nbFrames);
+    std::vector<int> contactFrames;
+    for (int frame = 0; frame < nbFrames; frame++) {
+        if (weights[frame] > 0.0) {
+            for (int i = 0; i < 3; i++) {
+                double position = positions[3 * frame + i];
+                targets[3 * frame + i] = position + weights[frame] * (pins[3 * frame + i] - position);
+            }
+            contactFrames.push_back(frame);
+        }
+    }
+
+    // The chain was checked by run(), both joints have three rotation channels
+    std::vector<char> needed = neededJoints(skeleton, std::vector<int>(1, joint));
+    parallelFor(contactFrames.size(), nbThreads, [&](int begin, int end) {
+        std::vector<RigidTransform> world;
+        for (int n = begin; n < end; n++) {
+            int frame = contactFrames[n];
+            evaluateFrame(skeleton, motion, frame, needed, world);
+            const double* a = world[hip].translation;
+            const double* b = world[knee].translation;
+            const double* c = world[joint].translation;
+            const double* t = &targets[3 * frame];
+
+            if (aim) {
+                // Knee only: turn the bone toward the target around the pinned knee
+                double bc[3], bt[3], axis[3], rotation[9], kneeWorld[9], kneeLocal[9];
+                for (int i = 0; i < 3; i++) {
+                    bc[i] = c[i] - b[i];
+                    bt[i] = t[i] - b[i];
+                }
+                cross3(bc, bt, axis);
+                double axisLength = length3(axis);
+                if (axisLength < 1e-9) {
+                    continue;
+                }
+                for (int i = 0; i < 3; i++) {
+                    axis[i] /= axisLength;
+                }
+                axisAngle(axis, angleBetween(bc, bt), rotation);
+                multiply3(rotation, world[knee].rotation, kneeWorld);
+                multiply3(world[hip].rotation, kneeWorld, kneeLocal, true);
+                setRotationChannels(skeleton, motion, knee, frame, kneeLocal);
+                continue;
+            }
+
+            double ba[3], bc[3], ac[3], at[3];
+            for (int i = 0; i < 3; i++) {
+                ba[i] = a[i] - b[i];
+                bc[i] = c[i] - b[i];
+                at[i] = t[i] - a[i];
+            }
+            double thigh = length3(ba);
+            double shin = length3(bc);
+            if (thigh <= 0.0 || shin <= 0.0) {
+                continue;
+            }
+
+            // Knee: bend in the plane of the leg to reach the target distance
+            double distance = std::max(std::fabs(thigh - shin) + 1e-6, std::min(thigh + shin - 1e-6, length3(at)));
+            double cosine = (thigh * thigh + shin * shin - distance * distance) / (2.0 * thigh * shin);
+            double kneeAngle = std::acos(std::max(-1.0, std::min(1.0, cosine)));
+            double kneeAxis[3];
+            cross3(ba, bc, kneeAxis);
+            double axisLength = length3(kneeAxis);
+            if (axisLength < 1e-9) {
+                // Straight leg, bend around the knee x axis
+                kneeAxis[0] = world[knee].rotation[0];
+                kneeAxis[1] = world[knee].rotation[3];
+                kneeAxis[2] = world[knee].rotation[6];
+                axisLength = length3(kneeAxis);
+            }
+            for (int i = 0; i < 3; i++) {
+                kneeAxis[i] /= axisLength;
+            }
+            double kneeRotation[9];
+            axisAngle(kneeAxis, kneeAngle - angleBetween(ba, bc), kneeRotation);
+
+            // Hip: swing the bent leg onto the target
+            double bent[3];
+            for (int i = 0; i < 3; i++) {
+                bent[i] = kneeRotation[3 * i] * bc[0] + kneeRotation[3 * i + 1] * bc[1] + kneeRotation[3 * i + 2] * bc[2];
+                ac[i] = b[i] + bent[i] - a[i];
+            }
+            double hipAxis[3];
+            cross3(ac, at, hipAxis);
+            double hipRotation[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+            axisLength = length3(hipAxis);
+            if (axisLength > 1e-9) {
+                for (int i = 0; i < 3; i++) {
+                    hipAxis[i] /= axisLength;
+                }
+                axisAngle(hipAxis, angleBetween(ac, at), hipRotation);
+            }
+
+            // New locals: hip = parent^-1 * Q * hip, knee = hip^-1 * K * knee
+            double hipWorld[9], hipLocal[9], kneeWorld[9], kneeLocal[9];
+            multiply3(hipRotation, world[hip].rotation, hipWorld);
+            int hipParent = skeleton.parents[hip];
+            if (hipParent >= 0) {
+                multiply3(world[hipParent].rotation, hipWorld, hipLocal, true);
+            }
+            else {
+                std::memcpy(hipLocal, hipWorld, sizeof(hipWorld));
+            }
+            multiply3(kneeRotation, world[knee].rotation, kneeWorld);
+            multiply3(world[hip].rotation, kneeWorld, kneeLocal, true);
+
+            setRotationChannels(skeleton, motion, hip, frame, hipLocal);
+            setRotationChannels(skeleton, motion, knee, frame, kneeLocal);
+        }
+    });
+    return contactFrames.size();
+}
+
+TrajectoryIndex trajectoryIndex;
+
+void TrajectoryIndex::add(const MString& file, const Clip& clip, int nbThreads) {
+    remove(file);
+
+    const MotionMatrix& motion = clip.motion;
+    int windowFrames = (int)std::round(kWindow / motion.frameTime);
+    int strideFrames = std::max(1, (int)std::round(kStride / motion.frameTime));
+    if (motion.nbFrames <= windowFrames || clip.compiled.nbJoints() == 0) {
+        return;
+    }
+
+    // Root planar position and heading of every frame, from the batch FK.
+    // The heading is the angle of the root +Z axis around Y.
+    std::vector<double> x(motion.nbFrames), z(motion.nbFrames), heading(motion.nbFrames);
+    std::vector<char> needed = neededJoints(clip.compiled, std::vector<int>(1, 0));
+    parallelFor(motion.nbFrames, nbThreads, [&](int begin, int end) {
+        std::vector<RigidTransform> world;
+        for (int frame = begin; frame < end; frame++) {
+            evaluateFrame(clip.compiled, motion, frame, needed, world);
+            x[frame] = world[0].translation[0];
+            z[frame] = world[0].translation[2];
+            heading[frame] = std::atan2(world[0].rotation[2], world[0].rotation[8]);
+        }
+    });
+    std::vector<double> speed(motion.nbFrames);
+    for (int frame = 0; frame < motion.nbFrames; frame++) {
+        if (frame > 0) {
+            heading[frame] -= 2.0 * M_PI * std::round((heading[frame] - heading[frame - 1]) / (2.0 * M_PI));
+        }
+        int previous = std::max(frame - 1, 0);
+        int next = std::min(frame + 1, motion.nbFrames - 1);
+        speed[frame] = std::hypot(x[next] - x[previous], z[next] - z[previous]) / ((next - previous) * motion.frameTime);
+    }
+
+    int nbNewWindows = (motion.nbFrames - 1 - windowFrames) / strideFrames + 1;
+    size_t first = startFrames.size();
+    int fileId = files.size();
+    files.push_back(file);
+    fileIds.resize(first + nbNewWindows, fileId);
+    startFrames.resize(first + nbNewWindows);
+    endFrames.resize(first + nbNewWindows);
+    features.resize((first + nbNewWindows) * kFeatures);
+
+    parallelFor(nbNewWindows, nbThreads, [&](int begin, int end) {
+        for (int window = begin; window < end; window++) {
+            int startFrame = window * strideFrames;
+            startFrames[first + window] = startFrame;
+            endFrames[first + window] = startFrame + windowFrames;
+            float* windowFeatures = &features[(first + window) * kFeatures];
+            double c = std::cos(heading[startFrame]);
+            double s = std::sin(heading[startFrame]);
+            for (int sample = 0; sample < kSamples; sample++) {
+                // Linear interpolation between the frames around the sample
+                double position = startFrame + (double)windowFrames * sample / (kSamples - 1);
+                int frame = std::min((int)position, motion.nbFrames - 2);
+                double t = position - frame;
+                double dx = x[frame] + t * (x[frame + 1] - x[frame]) - x[startFrame];
+                double dz = z[frame] + t * (z[frame + 1] - z[frame]) - z[startFrame];
+                windowFeatures[4 * sample] = (float)(dx * c - dz * s);
+                windowFeatures[4 * sample + 1] = (float)(dx * s + dz * c);
+                windowFeatures[4 * sample + 2] = (float)(heading[frame] + t * (heading[frame + 1] - heading[frame]) - heading[startFrame]);
+                windowFeatures[4 * sample + 3] = (float)(speed[frame] + t * (speed[frame + 1] - speed[frame]));
+            }
+        }
+    });
+}
+
+// add() removes a file before indexing it again, so a file has one id. The
+// ids after it move down by one.
+void TrajectoryIndex::remove(const MString& file) {
+    int fileId = std::find(files.begin(), files.end(), file) - files.begin();
+    if (fileId == (int)files.size()) {
+        return;
+    }
+    files.erase(files.begin() + fileId);
+
+    size_t kept = 0;
+    for (size_t window = 0; window < startFrames.size(); window++) {
+        if (fileIds[window] == fileId) {
+            continue;
+        }
+        fileIds[kept] = fileIds[window] > fileId ? fileIds[window] - 1 : fileIds[window];
+        startFrames[kept] = startFrames[window];
+        endFrames[kept] = endFrames[window];
+        std::memmove(&features[kept * kFeatures], &features[window * kFeatures], kFeatures * sizeof(float));
+        kept++;
+    }
+    fileIds.resize(kept);
+    startFrames.resize(kept);
+    endFrames.resize(kept);
+    features.resize(kept * kFeatures);
+}
+
+void TrajectoryIndex::clear() {
+    files.clear();
+    fileIds.clear();
+    startFrames.clear();
+    endFrames.clear();
+    features.clear();
+}
+
+void TrajectoryIndex::pathFeatures(double turn, double startSpeed, double endSpeed, float* features) {
+    // Integrated in small steps, kSteps per sample interval
+    const int kSteps = 16;
+    double dt = kWindow / ((kSamples - 1) * kSteps);
+    double x = 0.0;
+    double z = 0.0;
+    for (int sample = 0; sample < kSamples; sample++) {
+        double u = (double)sample / (kSamples - 1);
+        features[4 * sample] = (float)x;
+        features[4 * sample + 1] = (float)z;
+        features[4 * sample + 2] = (float)(turn * M_PI / 180.0 * u);
+        features[4 * sample + 3] = (float)std::fabs(startSpeed + (endSpeed - startSpeed) * u);
+        for (int step = 0; step < kSteps && sample + 1 < kSamples; step++) {
+            double v = (sample * kSteps + step + 0.5) / ((kSamples - 1) * kSteps);
+            double heading = turn * M_PI / 180.0 * v;
+            double speed = startSpeed + (endSpeed - startSpeed) * v;
+            x += speed * std::sin(heading) * dt;
+            z += speed * std::cos(heading) * dt;
+        }
+    }
+}
+
+std::vector<TrajectoryIndex::Match> TrajectoryIndex::query(const float* queryFeatures, int count,
+                                                          double headingWeight, double speedWeight) const {
+    float weights[4] = { 1.0f, 1.0f, (float)(headingWeight * headingWeight), (float)(speedWeight * speedWeight) };
+    typedef std::pair<float, int> Candidate;
+
+    // Each thread keeps its count best windows in a max-heap, and stops the
+    // distance of a window as soon as it exceeds the worst of them.
+    int nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::vector<Candidate>> heaps(nbThreads);
+    int blockSize = (nbWindows() + nbThreads - 1) / nbThreads;
+    parallelFor(nbThreads, nbThreads, [&](int begin, int end) {
+        for (int block = begin; block < end; block++) {
+            std::vector<Candidate>& heap = heaps[block];
+            int last = std::min(nbWindows(), (block + 1) * blockSize);
+            for (int window = block * blockSize; window < last; window++) {
+                const float* windowFeatures = &features[(size_t)window * kFeatures];
+                float bound = (int)heap.size() == count ? heap.front().first : std::numeric_limits<float>::max();
+                float distance = 0.0f;
+                for (int i = 0; i < kFeatures && distance < bound; i++) {
+                    float d = windowFeatures[i] - queryFeatures[i];
+                    distance += weights[i % 4] * d * d;
+                }
+                if (distance >= bound) {
+                    continue;
+                }
+                if ((int)heap.size() == count) {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.pop_back();
+                }
+                heap.push_back(Candidate(distance, window));
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    });
+
+    std::vector<Candidate> candidates;
+    for (const std::vector<Candidate>& heap : heaps) {
+        candidates.insert(candidates.end(), heap.begin(), heap.end());
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.resize(std::min<size_t>(candidates.size(), count));
+
+    std::vector<Match> matches;
+    for (const Candidate& candidate : candidates) {
+        Match match;
+        match.file = files[fileIds[candidate.second]];
+        match.startFrame = startFrames[candidate.second];
+        match.endFrame = endFrames[candidate.second];
+        match.distance = std::sqrt(candidate.first);
+        matches.push_back(match);
+    }
+    return matches;
+}
+
+int compileClip(Clip& clip) {
+    int nbChannels = 0;
+    for (Node& node : clip.skeleton) {
+        node.channelOffset = nbChannels;
+        nbChannels += node.channels.size();
+    }
+    clip.compiled.compile(clip.skeleton);
+    return nbChannels;
+}
+
+void createClip(std::unique_ptr<Clip> clip, const ImportPlan& plan, const FootCleanup& footCleanup,
+                std::chrono::steady_clock::time_point startTime,
+                std::chrono::steady_clock::time_point headerTime) {
+    std::vector<Node>& skeleton = clip->skeleton;
+    MotionMatrix& motion = clip->motion;
+
+    int nbCorrected = plan.createScene ? footCleanup.run(*clip, motion, plan.nbThreads) : 0;
+
+    trajectoryIndex.add(clip->file, *clip, plan.nbThreads);
+
+    std::chrono::steady_clock::time_point motionTime = std::chrono::steady_clock::now();
+
+    //Create BVH
+    if (plan.createScene) {
+        for (Node& node : skeleton) {
+            node.mayaCreate(skeleton, motion);
+        }
+        clip->indexJoints();
+    }
+
+    std::chrono::steady_clock::time_point createTime = std::chrono::steady_clock::now();
+
+    typedef std::chrono::duration<double, std::milli> Milliseconds;
+    MString stats("bvhTranslator: ");
+    stats += clip->file;
+    stats += ", ";
+    stats += (unsigned int)skeleton.size();
+    stats += " joints, ";
+    stats += motion.nbChannels;
+    stats += " channels, ";
+    stats += motion.nbFrames;
+    stats += " frames";
+    if (!footCleanup.joints.empty()) {
+        stats += ", ";
+        stats += nbCorrected;
+        stats += " foot contact frames corrected";
+    }
+    stats += ". Plan: ";
+    stats += plan.describe();
+    stats += ". Header ";
+    stats += Milliseconds(headerTime - startTime).count();
+    stats += " ms, motion ";
+    stats += Milliseconds(motionTime - headerTime).count();
+    stats += " ms, scene ";
+    stats += Milliseconds(createTime - motionTime).count();
+    stats += " ms.";
+    MGlobal::displayInfo(stats);
+
+    if (plan.createScene && plan.cacheClip) {
+        // Clips whose joints were all deleted can not be used any more
+        importedClips.erase(std::remove_if(importedClips.begin(), importedClips.end(),
+                                           [](const std::unique_ptr<Clip>& cached) { return !cached->isAlive(); }),
+                            importedClips.end());
+        importedClips.push_back(std::move(clip));
+    }
+}
+
@@ -0,0 +1,332 @@
+////////////////////////////////////////////////////////////////////////
+// DESCRIPTION:
+//
+// Clips shared by the Bvh and AsfAmc translators and by the commands of the
+// plug-in: the motion matrix and the flat skeleton of a parsed file, the
+// import plan, the batch forward kinematics, the foot-skate cleanup and the
+// trajectory index of the motion library.
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _clip_h
+#define _clip_h
+
+#include <maya/MString.h>
+#include <maya/MObject.h>
+#include <maya/MObjectHandle.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265359
+#endif
+
+// Column types of the compiled skeleton
+enum ChannelType {
+    kPositionX, kPositionY, kPositionZ,
+    kRotationX, kRotationY, kRotationZ
+};
+
+// Channel values of every frame, one row per frame with the channels in file
+// order. Large takes can be stored in single precision to halve the memory
+// footprint, the text values rarely carry more digits than a float holds.
+class MotionMatrix {
+public:
+    int nbFrames = 0;
+    int nbChannels = 0;
+    double frameTime = 0.0;
+    bool singlePrecision = false;
+    std::vector<float> floatValues;
+    std::vector<double> doubleValues;
+
+    void allocate(int nbFrames, int nbChannels, double frameTime, bool singlePrecision);
+
+    double value(int frame, int channel) const {
+        size_t index = (size_t)frame * nbChannels + channel;
+        return singlePrecision ? floatValues[index] : doubleValues[index];
+    }
+
+    // Keeps the values of the first frames
+    void resizeFrames(int nbFrames);
+
+    void setValue(int frame, int channel, double value) {
+        size_t index = (size_t)frame * nbChannels + channel;
+        if (singlePrecision) {
+            floatValues[index] = (float)value;
+        }
+        else {
+            doubleValues[index] = value;
+        }
+    }
+
+    // Row of a frame in the storage selected by singlePrecision
+    template <typename T>
+    T* row(int frame);
+};
+
+template <>
+float* MotionMatrix::row<float>(int frame);
+
+template <>
+double* MotionMatrix::row<double>(int frame);
+
+// A joint of the parsed hierarchy. Joints are stored in a flat vector in
+// depth-first (file) order, so a parent always comes before its children and
+// the order matches the channel order of a MOTION frame. The hierarchy is
+// described by the parent index only, which keeps every pass over the
+// skeleton a simple loop, whatever its depth or width.
+class Node {
+private:
+public:
+    std::string name;
+    float offset[3];
+    std::vector<std::string> channels;
+    MObject jointObj;
+    MObject animCurveObj;
+
+    int parent = -1;
+    // Column of the first channel of the joint in the motion matrix
+    int channelOffset = 0;
+    Node();
+    Node(std::string name, float offset[3], std::vector<std::string> channels);
+    ~Node();
+
+    void mayaCreate(const std::vector<Node>& skeleton, const MotionMatrix& motion);
+};
+
+// Compact form of the skeleton for the batch evaluation of a clip: the
+// parent, offset and channel columns of every joint, and the type of every
+// column of the motion matrix.
+class CompiledSkeleton {
+public:
+    std::vector<int> parents;
+    std::vector<double> offsets;
+    std::vector<int> channelOffsets;
+    std::vector<int> channelCounts;
+    std::vector<unsigned char> channelTypes;
+
+    int nbJoints() const { return parents.size(); }
+
+    void compile(const std::vector<Node>& skeleton);
+};
+
+// A parsed file kept after its import, so that the commands of the plug-in
+// can work on the motion without evaluating the Maya scene.
+class Clip {
+public:
+    MString file;
+    std::vector<Node> skeleton;
+    CompiledSkeleton compiled;
+    MotionMatrix motion;
+
+    // Handles of the created joints, and their indices by hash code
+    std::vector<MObjectHandle> jointHandles;
+    std::unordered_multimap<unsigned int, int> jointIndices;
+
+    void indexJoints();
+    bool isAlive() const;
+    int findJoint(const MObject& jointObj) const;
+};
+
+// Clips imported in the current scene, released when a scene is created or opened
+extern std::vector<std::unique_ptr<Clip>> importedClips;
+
+// How the motion of a file is read, decided once the header is parsed.
+// Small files take the simple token stream, large ones the pointer based
+// tokenizer split across threads, and files that do not fit comfortably in
+// memory are streamed frame block by frame block into a float matrix.
+class ImportPlan {
+public:
+    bool fastTokenizer = false;
+    int nbThreads = 1;
+    bool singlePrecision = false;
+    bool stream = false;
+    bool createScene = true;
+    bool cacheClip = true;
+
+    void build(unsigned long long fileSize, int nbFrames, int nbChannels);
+    bool applyOptions(const MString& options);
+    MString describe() const;
+};
+
+// Splits the translator options in (name, value) pairs
+std::vector<std::pair<MString, MString>> splitOptions(const MString& options);
+
+// Runs task(begin, end) over [0, count) split in contiguous blocks, one block
+// per thread. The calling thread takes the first block.
+template <typename Task>
+void parallelFor(int count, int nbThreads, const Task& task) {
+    nbThreads = std::max(1, std::min(nbThreads, count));
+    if (nbThreads == 1) {
+        task(0, count);
+        return;
+    }
+    std::vector<std::thread> threads;
+    int blockSize = (count + nbThreads - 1) / nbThreads;
+    for (int begin = blockSize; begin < count; begin += blockSize) {
+        threads.emplace_back(task, begin, std::min(begin + blockSize, count));
+    }
+    task(0, std::min(blockSize, count));
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+inline void parseValue(const char* p, char** end, float& value) { value = std::strtof(p, end); }
+inline void parseValue(const char* p, char** end, double& value) { value = std::strtod(p, end); }
+
+// Decodes the nbChannels values of the frame held in [begin, end). Fails if
+// the line holds fewer or more values than expected.
+template <typename T>
+bool decodeFrame(const char* begin, const char* end, T* row, int nbChannels) {
+    const char* p = begin;
+    for (int i = 0; i < nbChannels; i++) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        if (p >= end) {
+            return false;
+        }
+        char* next;
+        parseValue(p, &next, row[i]);
+        if (next == p || next > end) {
+            return false;
+        }
+        p = next;
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p == end;
+}
+
+// World positions of the given joints for every frame of [firstFrame,
+// lastFrame], frames being evaluated in parallel on nbThreads threads.
+// positions holds the x, y, z of each joint, frame after frame.
+void computeWorldPositions(const Clip& clip, int firstFrame, int lastFrame, const std::vector<int>& joints,
+                           int nbThreads, std::vector<double>& positions);
+
+// Rotation of angle radians around a unit axis (Rodrigues)
+void axisAngle(const double axis[3], double angle, double rotation[9]);
+
+// c = a * b, or c = transpose(a) * b if transposeA
+void multiply3(const double a[9], const double b[9], double c[9], bool transposeA = false);
+
+// Writes the rotation back into the three rotation channels of a joint, as
+// angles in degrees for rotations applied in channel order. The Euler
+// solution nearest to the values already in the channels is kept, so that
+// an edited frame does not flip away from the original curve.
+// Returns false if the joint does not have three distinct rotation channels.
+bool setRotationChannels(const CompiledSkeleton& skeleton, MotionMatrix& motion,
+                         int joint, int frame, const double rotation[9]);
+
+// Makes the rotation channels of a joint continuous, frame after frame: each
+// frame takes the Euler solution nearest to the previous frame.
+void makeEulerContinuous(const CompiledSkeleton& skeleton, MotionMatrix& motion, int joint);
+
+// Foot-skate cleanup, run on the motion matrix before the keys are created.
+// For each configured joint, the frames where it is low and slow enough are
+// contacts. Consecutive contact frames form an interval over which the joint
+// is pinned to its mean position, by an analytic two-bone IK on its parent
+// (knee) and grand-parent (hip) solved per frame, in parallel. The pin eases
+// in and out over the blend time on either side of an interval.
+//
+// Joints are cleaned from the shallowest. A joint whose parent is already
+// pinned (a toe below its ankle) is solved by rotating that parent only, an
+// aim that leaves the pinned parent in place. Any other joint whose chain
+// would move a pinned one, such as two toes of the same ankle or a heel
+// next to an ankle, is reported and not cleaned.
+//
+// Options: footContacts=lfoot,rfoot names the joints, footHeight and
+// footSpeed override the contact thresholds. They default to 5% of the leg
+// length above the lowest position of the joint and to one leg length per
+// second. footBlend sets the blend time, 0.1 s by default.
+class FootCleanup {
+public:
+    std::vector<std::string> joints;
+    double heightThreshold = -1.0;
+    double speedThreshold = -1.0;
+    double blendTime = 0.1;
+
+    bool applyOptions(const MString& options);
+    // Returns the number of frames corrected, solved on nbThreads threads
+    int run(const Clip& clip, MotionMatrix& motion, int nbThreads) const;
+
+private:
+    // aim rotates the parent only, instead of the two-bone chain
+    int cleanJoint(const Clip& clip, MotionMatrix& motion, int joint, bool aim, int nbThreads) const;
+};
+
+// Index of the root trajectories of the clips of the motion library, for
+// searches by path shape ("turn left 90 degrees while running"). Every clip
+// is cut in windows of kWindow seconds every kStride seconds. A window is
+// stored as kSamples resampled samples of the root planar path, heading and
+// speed, normalized so that the window starts at the origin facing +Z. The
+// features of all windows are packed in one float array, scanned in
+// parallel by the queries.
+class TrajectoryIndex {
+public:
+    static const int kSamples = 16;
+    // x, z, heading and speed per sample
+    static const int kFeatures = 4 * kSamples;
+    static constexpr double kWindow = 2.0;
+    static constexpr double kStride = 0.5;
+
+    class Match {
+    public:
+        MString file;
+        int startFrame;
+        int endFrame;
+        double distance;
+    };
+
+    // Replaces the windows of the file, if already indexed. The windows are
+    // built on nbThreads threads.
+    void add(const MString& file, const Clip& clip, int nbThreads);
+    void remove(const MString& file);
+    void clear();
+    int nbWindows() const { return startFrames.size(); }
+
+    // Features of the window of a path turning by turn degrees (to the left,
+    // counter-clockwise seen from above) at a speed going linearly from
+    // startSpeed to endSpeed, negative speeds moving backward.
+    static void pathFeatures(double turn, double startSpeed, double endSpeed, float* features);
+
+    // The count nearest windows to features. headingWeight is the distance
+    // given to one radian of heading and speedWeight the duration given to
+    // the speed profile, positions counting as they are.
+    std::vector<Match> query(const float* features, int count, double headingWeight, double speedWeight) const;
+
+private:
+    std::vector<MString> files;
+    std::vector<int> fileIds;
+    std::vector<int> startFrames;
+    std::vector<int> endFrames;
+    std::vector<float> features;
+};
+
+extern TrajectoryIndex trajectoryIndex;
+
+// Gives each joint the column of its first channel and compiles the
+// skeleton. The channels of a frame are listed in the depth-first order of
+// the hierarchy, which is the order of the skeleton vector. Returns the
+// number of channels of a frame.
+int compileClip(Clip& clip);
+
+// Last stages shared by the importers once the motion matrix is filled:
+// foot-skate cleanup, creation of the joints and keys, and stats. The clip
+// is added to the trajectory index, then kept for the commands of the
+// plug-in, unless only the index was asked for or the cache is disabled.
+void createClip(std::unique_ptr<Clip> clip, const ImportPlan& plan, const FootCleanup& footCleanup,
+                std::chrono::steady_clock::time_point startTime,
+                std::chrono::steady_clock::time_point headerTime);
+
+#endif
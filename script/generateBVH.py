@@ -0,0 +1,123 @@
+#exec(open("<repo>/script/generateBVH.py", "r").read())
+# Generates synthetic BVH skeletons to stress the importer, and times their
+# import when run inside Maya with the bvhTranslator plug-in loaded.
+#
+# Presets :
+#   "deep" : a single chain of `size` joints (tails, ropes, cloth chains)
+#   "wide" : a root with `size` short chains of `depth` joints
+#
+# Outside of Maya : python generateBVH.py <deep|wide> <size> <frames> <output.bvh>
+import math
+import os
+import sys
+import tempfile
+import time
+
+CHANNELS_ROOT = "CHANNELS 6 Xposition Yposition Zposition Zrotation Yrotation Xrotation"
+CHANNELS_JOINT = "CHANNELS 3 Zrotation Yrotation Xrotation"
+
+
+class Joint:
+
+    def __init__(self, name, offset, children=None):
+        if children == None: children = []
+        self.name = name
+        self.offset = offset
+        self.children = children
+
+
+def deepPreset(size):
+    root = Joint("root", [0.0, 0.0, 0.0])
+    node = root
+    for i in range(size - 1):
+        child = Joint(f"chain{i}", [0.0, 0.0, 1.0])
+        node.children.append(child)
+        node = child
+    return root
+
+
+def widePreset(size, depth=3):
+    root = Joint("root", [0.0, 0.0, 0.0])
+    for i in range(size):
+        angle = 2.0 * math.pi * i / size
+        node = root
+        for j in range(depth):
+            child = Joint(f"branch{i}_{j}", [math.cos(angle), 0.0, math.sin(angle)])
+            node.children.append(child)
+            node = child
+    return root
+
+
+presets = {
+    "deep" : deepPreset,
+    "wide" : widePreset,
+}
+
+
+def writeBVH(root, nbFrames, file, frameTime=1.0 / 30.0):
+    # Hierarchy and frame order are both depth-first. Iterative on purpose,
+    # the chains are deeper than Python's recursion limit. Indentation is
+    # capped, a fully indented chain would grow quadratically with its depth.
+    lines = ["HIERARCHY"]
+    order = []
+    stack = [(root, 0, False)]
+    while stack:
+        node, level, closing = stack.pop()
+        indent = "\t" * min(level, 8)
+        if closing:
+            lines.append(indent + "}")
+            continue
+        keyWord = "ROOT" if node is root else "JOINT"
+        lines.append(f"{indent}{keyWord} {node.name}")
+        lines.append(indent + "{")
+        lines.append(f"{indent}\tOFFSET {node.offset[0]:.5f} {node.offset[1]:.5f} {node.offset[2]:.5f}")
+        lines.append(indent + "\t" + (CHANNELS_ROOT if node is root else CHANNELS_JOINT))
+        order.append(node)
+        stack.append((node, level, True))
+        if not node.children:
+            lines.append(indent + "\tEnd Site")
+            lines.append(indent + "\t{")
+            lines.append(indent + "\t\tOFFSET 0.00000 0.00000 1.00000")
+            lines.append(indent + "\t}")
+        for child in reversed(node.children):
+            stack.append((child, level + 1, False))
+
+    lines.append("MOTION")
+    lines.append(f"Frames: {nbFrames}")
+    lines.append(f"Frame Time: {frameTime:.6f}")
+    nbChannels = 3 + 3 * len(order)
+    for frame in range(nbFrames):
+        phase = 2.0 * math.pi * frame / max(nbFrames, 1)
+        values = [0.0, 0.0, float(frame) * 0.1]
+        values += [10.0 * math.sin(phase + 0.01 * k) for k in range(nbChannels - 3)]
+        lines.append(" ".join(f"{v:.4f}" for v in values))
+
+    with open(file, 'w') as fch:
+        fch.write("\n".join(lines))
+        fch.write("\n")
+
+    return len(order)
+
+
+def benchmark(cases=None, nbFrames=100):
+    import maya.cmds as cmds
+
+    if cases == None:
+        cases = [("deep", 1000), ("deep", 5000), ("wide", 1000), ("wide", 4000)]
+
+    directory = tempfile.mkdtemp()
+    for preset, size in cases:
+        file = os.path.join(directory, f"{preset}{size}.bvh")
+        nbJoints = writeBVH(presets[preset](size), nbFrames, file)
+
+        cmds.file(new=True, force=True)
+        start = time.perf_counter()
+        cmds.file(file, i=True, type="Bvh")
+        elapsed = time.perf_counter() - start
+        print(f"{preset:>5} {size:>6} : {nbJoints:>6} joints, {nbFrames} frames, {elapsed:.3f} s")
+
+
+if __name__ == "__main__" and len(sys.argv) == 5:
+    preset, size, nbFrames, file = sys.argv[1:]
+    nbJoints = writeBVH(presets[preset](int(size)), int(nbFrames), file)
+    print(f"{file} : {nbJoints} joints, {nbFrames} frames")